@@ -11,6 +11,7 @@
 */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/printk.h>
 #include <linux/types.h>
@@ -18,28 +19,512 @@
 #include <linux/slab.h>  /* kmalloc */
 #include <linux/gfp.h>  /* kmalloc flags */
 #include <linux/tty.h>
-#include <linux/kfifo.h> /* kfifo circular buffer */
 #include <linux/string.h>
+#include <linux/mm.h> /* remap_vmalloc_range */
+#include <linux/vmalloc.h> /* vmalloc_user */
+#include <linux/kref.h>
+#include <linux/anon_inodes.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/ctype.h>
+#include <linux/kernel.h> /* hex_to_bin */
+#include <linux/math64.h>
+#include <linux/ktime.h>
+#include <linux/hash.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/unaligned.h>
 
+#include "gnssposget_ioctl.h"
 #include "aesd-gnssposget-driver.h"
 
+#define CREATE_TRACE_POINTS
+#include "gnssposget_trace.h"
+
 #define N_GNSSPOSGET 20
 #define GNSSPOSGET_BUSY	1
 #define GNSSPOSGET_ACTIVE	2
 
-DEFINE_KFIFO(nmea_kfifo, struct nmea_cbuf, CIRC_BUFFER_SIZE);
-
 MODULE_AUTHOR("JustOxy666");
 MODULE_LICENSE("Dual BSD/GPL");
 
+static unsigned int ring_size = RING_SIZE_DEFAULT;
+module_param(ring_size, uint, S_IRUGO);
+MODULE_PARM_DESC(ring_size, "Receive ring capacity in bytes per tty (rounded up to a power of two)");
+
+static unsigned int ack_timeout_ms = 1000;
+module_param(ack_timeout_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(ack_timeout_ms, "How long write() waits for the receiver to acknowledge a UBX CFG command");
+
 static const char nmea_prefix[] = "$XXXXX";
-static const char gptxt_prefix[] = "$GPTXT";
-static const char gprmc_prefix[] = "$GPRMC";
-static const char gpgsv_prefix[] = "$GPGSV";
 #define NMEA_LEN           (sizeof(nmea_prefix) - 1)
 
+/* Accepted until userspace sets its own filter */
+static const char * const default_filter[] = { "GPTXT", "GPRMC", "GPGSV" };
+
 struct n_gnssposget *gnssposget_ldisc;
+static struct dentry *gnssposget_debugfs;
+
+/*----------------------------------------
+     Receive ring
+/*----------------------------------------*/
+#define REC_HDR_LEN        (sizeof(struct gnssposget_rec))
+/* Most bytes the tty core asks for per call, its kernel buffer in iterate_tty_read() */
+#define GNSSPOSGET_READ_CHUNK  (64)
+
+static inline struct gnssposget_rec *ring_rec(struct gnssposget_ring *ring, u32 pos)
+{
+    return (struct gnssposget_rec *)&ring->data[pos & (ring->size - 1)];
+}
+
+static struct gnssposget_ring *gnssposget_ring_alloc(unsigned int size)
+{
+    struct gnssposget_ring *ring;
+
+    ring = kzalloc(sizeof(struct gnssposget_ring), GFP_KERNEL);
+    if (!ring)
+        return NULL;
+
+    ring->size = roundup_pow_of_two(max_t(unsigned int, size, RING_SIZE_MIN));
+
+    /* Header gets a page of its own so the record area is page aligned */
+    ring->hdr = vmalloc_user(PAGE_SIZE + ring->size);
+    if (!ring->hdr) {
+        kfree(ring);
+        return NULL;
+    }
+
+    ring->data = (U8 *)ring->hdr + PAGE_SIZE;
+    ring->hdr->size = ring->size;
+    ring->hdr->data_offset = PAGE_SIZE;
+    kref_init(&ring->ref);
+    init_waitqueue_head(&ring->wait);
+
+    return ring;
+}
+
+static void gnssposget_ring_free(struct kref *ref)
+{
+    struct gnssposget_ring *ring = container_of(ref, struct gnssposget_ring, ref);
+
+    vfree(ring->hdr);
+    kfree(ring);
+}
+
+/*
+ * Make sure everything up to @end can be written by dropping
+ * the oldest records. Called by the producer only.
+ * Returns number of records dropped, padding excluded.
+ */
+static u32 gnssposget_ring_reserve(struct gnssposget_ring *ring, u32 end)
+{
+    u32 tail = ring->hdr->tail;
+    u32 head = ring->hdr->head;
+    u32 dropped = 0;
+
+    if ((end - tail) <= ring->size)
+        return 0;
+
+    while (((end - tail) > ring->size) && (tail != head)) {
+        PDEBUG("Ring full! Dropping oldest record\n");
+        if (ring_rec(ring, tail)->type != GNSSPOSGET_REC_PAD)
+            dropped++;
+        tail += GNSSPOSGET_REC_SIZE(ring_rec(ring, tail)->len);
+    }
+
+    /* Readers must see the new tail before the old records get overwritten */
+    WRITE_ONCE(ring->hdr->tail, tail);
+    smp_wmb();
+
+    trace_gnssposget_overflow(dropped, tail, head, ring->size);
+    return dropped;
+}
+
+/* Appends @count bytes to the frame being assembled */
+static void gnssposget_frame_append(struct n_gnssposget *n_gnssposget, const U8 *cp, int count)
+{
+    struct nmea_container *frame = n_gnssposget->nmeatxt;
+
+    memcpy(&frame->buf[frame->index], cp, count);
+    frame->index += count;
+}
+
+/*
+ * Copies the assembled frame into the ring after the last complete record
+ * and publishes it to readers. A record that would run past the end of the
+ * record area goes to its start and a padding record is left in its place,
+ * so records can always be read in place.
+ */
+static void gnssposget_frame_commit(struct n_gnssposget *n_gnssposget, u16 type)
+{
+    struct gnssposget_ring *ring = n_gnssposget->ring;
+    struct nmea_container *frame = n_gnssposget->nmeatxt;
+    u32 pos = ring->hdr->head;
+    u32 offset = pos & (ring->size - 1);
+    u32 needed = GNSSPOSGET_REC_SIZE(frame->index);
+    struct gnssposget_rec *rec;
+
+    if ((offset + needed) > ring->size) {
+        u32 wrap = pos + (ring->size - offset);
+
+        /* Oldest records go first, the padding may take the place of one */
+        n_gnssposget->stats.evicted += gnssposget_ring_reserve(ring, wrap + needed);
+        rec = ring_rec(ring, pos);
+        rec->len = ring->size - offset - REC_HDR_LEN;
+        rec->type = GNSSPOSGET_REC_PAD;
+        pos = wrap;
+    } else {
+        n_gnssposget->stats.evicted += gnssposget_ring_reserve(ring, pos + needed);
+    }
+
+    rec = ring_rec(ring, pos);
+    memcpy((U8 *)rec + REC_HDR_LEN, frame->buf, frame->index);
+    rec->len = frame->index;
+    rec->type = type;
+    rec->reserved = 0;
+    rec->stamp_ns = ktime_to_ns(frame->stamp);
+    smp_store_release(&ring->hdr->head, pos + needed);
+    wake_up_interruptible(&ring->wait);
+    wake_up_interruptible_poll(&n_gnssposget->tty->read_wait, EPOLLIN | EPOLLRDNORM);
+}
+
+/* Drops what was assembled and starts over */
+static void gnssposget_frame_reset(struct n_gnssposget *n_gnssposget, bool valid)
+{
+    n_gnssposget->nmeatxt->valid_frame = valid;
+    n_gnssposget->nmeatxt->ubx = false;
+    n_gnssposget->nmeatxt->ubx_left = 0;
+    n_gnssposget->nmeatxt->index = 0;
+}
+
+static U8 *gnssposget_frame_text(struct n_gnssposget *n_gnssposget)
+{
+    return n_gnssposget->nmeatxt->buf;
+}
+
+/* Has the record at @pos been overwritten since the reader looked at it */
+static inline bool ring_pos_lost(struct gnssposget_ring *ring, u32 pos)
+{
+    smp_rmb();
+    return (s32)(READ_ONCE(ring->hdr->tail) - pos) > 0;
+}
+
+static inline bool ring_pos_pending(struct gnssposget_ring *ring, u32 pos)
+{
+    return smp_load_acquire(&ring->hdr->head) != pos;
+}
+
+static inline bool gnssposget_cursor_pending(struct gnssposget_ring *ring,
+                                             struct gnssposget_cursor *cur)
+{
+    return (cur->fill != 0) || ring_pos_pending(ring, cur->pos);
+}
+
+/*
+ * Copies records starting at @cur into @buf without taking the producer
+ * lock, payload only or with the record header in front of it. A record
+ * is only started if all of it fits in @room, counted from @buf; @full
+ * tells that one didn't. Returns number of bytes copied.
+ */
+static size_t gnssposget_ring_read(struct gnssposget_ring *ring,
+                                   struct gnssposget_cursor *cur,
+                                   U8 *buf, size_t nr, bool with_hdr,
+                                   size_t room, bool *full)
+{
+    size_t copied = 0;
+
+    *full = false;
+    while (copied < nr) {
+        struct gnssposget_rec rec;
+        u32 offset = cur->pos & (ring->size - 1);
+        u32 skip = with_hdr ? 0 : REC_HDR_LEN;
+        size_t chunk = 0;
+        bool fits;
+        u32 total;
+
+        if (cur->fill != 0) {
+            /* Pad out a record that was overwritten while we were handing it out */
+            chunk = MIN(nr - copied, (size_t)cur->fill);
+            memset(&buf[copied], 0, chunk);
+            copied += chunk;
+            cur->fill -= chunk;
+            continue;
+        }
+
+        if (!ring_pos_pending(ring, cur->pos))
+            break;
+
+        rec = *ring_rec(ring, cur->pos);
+
+        /* A torn header must not take us past the record area */
+        rec.len = MIN(rec.len, ring->size - offset - REC_HDR_LEN);
+        total = REC_HDR_LEN + rec.len - skip;
+        fits = (rec.type == GNSSPOSGET_REC_PAD) || (cur->off != 0) || (total <= (room - copied));
+        if (fits && (rec.type != GNSSPOSGET_REC_PAD) && (cur->off < total)) {
+            chunk = MIN(nr - copied, (size_t)(total - cur->off));
+            memcpy(&buf[copied], &ring->data[offset + skip + cur->off], chunk);
+        }
+
+        if (ring_pos_lost(ring, cur->pos)) {
+            /* Overwritten under us. Finish what was handed out and restart from tail */
+            PDEBUG("Reader overrun, skipping to oldest record\n");
+            trace_gnssposget_reader_overrun(cur->pos, READ_ONCE(ring->hdr->tail));
+            cur->lost++;
+            if (cur->off != 0)
+                cur->fill = ((cur->type == GNSSPOSGET_REC_NMEA) && !with_hdr) ?
+                            1 : (cur->len - cur->off);
+            cur->pos = READ_ONCE(ring->hdr->tail);
+            cur->off = 0;
+            continue;
+        }
+
+        if (!fits) {
+            *full = true;
+            break;
+        }
+
+        cur->len = total;
+        cur->type = rec.type;
+        copied += chunk;
+        cur->off += chunk;
+        if ((rec.type == GNSSPOSGET_REC_PAD) || (cur->off >= total)) {
+            if (rec.type != GNSSPOSGET_REC_PAD)
+                trace_gnssposget_read_record(cur->pos, rec.type, rec.len, rec.stamp_ns);
+            cur->pos += GNSSPOSGET_REC_SIZE(rec.len);
+            cur->off = 0;
+        }
+    }
+
+    return copied;
+}
+
+static int gnssposget_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct gnssposget_ring *ring = file->private_data;
+
+    /* Readers never write to the ring */
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+    vma->vm_flags &= ~VM_MAYWRITE;
+    return remap_vmalloc_range(vma, ring->hdr, vma->vm_pgoff);
+}
+
+static long gnssposget_ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct gnssposget_ring *ring = file->private_data;
+    u32 pos;
+
+    if (_IOC_TYPE(cmd) != GNSSPOSGET_IOC_MAGIC) return -ENOTTY;
+    if (_IOC_NR(cmd) > GNSSPOSGET_IOC_MAXNR) return -ENOTTY;
+
+    switch (cmd) {
+        case GNSSPOSGET_IOCWAIT:
+            if (get_user(pos, (__u32 __user *)arg))
+                return -EFAULT;
+
+            if (wait_event_interruptible(ring->wait,
+                                         ring_pos_pending(ring, pos) || READ_ONCE(ring->dead)))
+                return -ERESTARTSYS;
+
+            return ring_pos_pending(ring, pos) ? 0 : -ENODEV;
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+static int gnssposget_ring_release(struct inode *inode, struct file *file)
+{
+    struct gnssposget_ring *ring = file->private_data;
+
+    kref_put(&ring->ref, gnssposget_ring_free);
+    return 0;
+}
+
+static const struct file_operations gnssposget_ring_fops = {
+    .owner          = THIS_MODULE,
+    .mmap           = gnssposget_ring_mmap,
+    .unlocked_ioctl = gnssposget_ring_ioctl,
+    .release        = gnssposget_ring_release,
+    .llseek         = noop_llseek,
+};
+
+/*----------------------------------------
+     Sentence filter
+/*----------------------------------------*/
+#define FILTER_ANY_TALKER       ("--")
+
+/*
+ * Packs a 5 character address into a non-zero key, 6 bits per character.
+ * Returns 0 for anything that can't be an address.
+ */
+static u32 nmea_addr_key(const U8 *addr)
+{
+    u32 key = 0;
+    int i;
+
+    for (i = 0; i < GNSSPOSGET_ADDR_LEN; i++) {
+        if ((addr[i] < 0x20) || (addr[i] > 0x5F))
+            return 0;
+        key = (key << 6) | (addr[i] - 0x20);
+    }
+
+    return key | BIT(31);
+}
+
+/* Linear probing from the hashed slot. Stops at the key or at an empty slot */
+static u32 *filter_slot(u32 *table, u32 key)
+{
+    u32 slot = hash_32(key, FILTER_HASH_BITS);
+    int probe;
+
+    for (probe = 0; probe < FILTER_SLOTS; probe++) {
+        if ((table[slot] == key) || (table[slot] == 0))
+            return &table[slot];
+        slot = (slot + 1) & (FILTER_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+static int gnssposget_filter_build(const struct gnssposget_filter *list, u32 *table, u8 *index)
+{
+    u32 key, *slot;
+    int i;
+
+    if (list->count > GNSSPOSGET_FILTER_MAX)
+        return -EINVAL;
+
+    memset(table, 0, FILTER_SLOTS * sizeof(u32));
+    memset(index, 0, FILTER_SLOTS);
+    for (i = 0; i < list->count; i++) {
+        key = nmea_addr_key((const U8 *)list->addr[i]);
+        if (!key)
+            return -EINVAL;
+
+        slot = filter_slot(table, key);
+        if (!slot)
+            return -ENOSPC;
+        *slot = key;
+        index[slot - table] = i;
+    }
+
+    return 0;
+}
+
+/*
+ * Exact address first, then the same sentence type from any talker.
+ * Returns the accepting filter_list entry or -1.
+ */
+static int gnssposget_filter_match(struct n_gnssposget *n_gnssposget, const U8 *addr)
+{
+    U8 any_talker[GNSSPOSGET_ADDR_LEN];
+    u32 *slot;
+    u32 key;
 
+    key = nmea_addr_key(addr);
+    if (!key)
+        return -1;
+
+    slot = filter_slot(n_gnssposget->filter, key);
+    if (slot && (*slot == key))
+        return n_gnssposget->filter_index[slot - n_gnssposget->filter];
+
+    memcpy(any_talker, FILTER_ANY_TALKER, 2);
+    memcpy(&any_talker[2], &addr[2], GNSSPOSGET_ADDR_LEN - 2);
+    key = nmea_addr_key(any_talker);
+    slot = filter_slot(n_gnssposget->filter, key);
+    if (slot && (*slot == key))
+        return n_gnssposget->filter_index[slot - n_gnssposget->filter];
+
+    return -1;
+}
+
+static void gnssposget_filter_default(struct n_gnssposget *n_gnssposget)
+{
+    int i;
+
+    n_gnssposget->filter_list.count = ARRAY_SIZE(default_filter);
+    for (i = 0; i < ARRAY_SIZE(default_filter); i++)
+        memcpy(n_gnssposget->filter_list.addr[i], default_filter[i], GNSSPOSGET_ADDR_LEN);
+
+    (void)gnssposget_filter_build(&n_gnssposget->filter_list, n_gnssposget->filter,
+                                  n_gnssposget->filter_index);
+}
+
+/*----------------------------------------
+     Statistics
+/*----------------------------------------*/
+static void gnssposget_stats_get(struct n_gnssposget *n_gnssposget, struct gnssposget_stats *stats)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    *stats = n_gnssposget->stats;
+    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+
+    mutex_lock(&n_gnssposget->mutex_lock);
+    stats->read_lost = n_gnssposget->read_lost;
+    stats->read_backlog_max = n_gnssposget->read_backlog_max;
+    mutex_unlock(&n_gnssposget->mutex_lock);
+
+    stats->ring_size = n_gnssposget->ring->size;
+}
+
+static int gnssposget_stats_show(struct seq_file *s, void *unused)
+{
+    struct n_gnssposget *n_gnssposget = s->private;
+    struct gnssposget_filter *list;
+    struct gnssposget_stats *stats;
+    unsigned long flags;
+    int i;
+
+    stats = kmalloc(sizeof(struct gnssposget_stats), GFP_KERNEL);
+    list = kmalloc(sizeof(struct gnssposget_filter), GFP_KERNEL);
+    if (!stats || !list) {
+        kfree(stats);
+        kfree(list);
+        return -ENOMEM;
+    }
+
+    gnssposget_stats_get(n_gnssposget, stats);
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    *list = n_gnssposget->filter_list;
+    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+
+    seq_printf(s, "rx_bytes:         %llu\n", stats->rx_bytes);
+    seq_printf(s, "accepted:         %u\n", stats->accepted);
+    for (i = 0; i < list->count; i++)
+        seq_printf(s, "  %.5s:          %u\n", list->addr[i], stats->accepted_by_addr[i]);
+    seq_printf(s, "filtered:         %u\n", stats->filtered);
+    for (i = 0; (i < GNSSPOSGET_FILTERED_MAX) && stats->filtered_addr[i][0]; i++)
+        seq_printf(s, "  %.5s:          %u\n", stats->filtered_addr[i], stats->filtered_by_addr[i]);
+    seq_printf(s, "bad_checksum:     %u\n", stats->bad_checksum);
+    seq_printf(s, "overlong:         %u\n", stats->overlong);
+    seq_printf(s, "truncated:        %u\n", stats->truncated);
+    seq_printf(s, "ubx_accepted:     %u\n", stats->ubx_accepted);
+    seq_printf(s, "ubx_bad_checksum: %u\n", stats->ubx_bad_checksum);
+    seq_printf(s, "ubx_oversized:    %u\n", stats->ubx_oversized);
+    seq_printf(s, "tty_errors:       %u\n", stats->tty_errors);
+    seq_printf(s, "  break:          %u\n", stats->breaks);
+    seq_printf(s, "  framing:        %u\n", stats->framing);
+    seq_printf(s, "  parity:         %u\n", stats->parity);
+    seq_printf(s, "  overrun:        %u\n", stats->overruns);
+    seq_printf(s, "evicted:          %u\n", stats->evicted);
+    seq_printf(s, "read_lost:        %u\n", stats->read_lost);
+    seq_printf(s, "read_backlog_max: %u/%u\n", stats->read_backlog_max, stats->ring_size);
+
+    kfree(stats);
+    kfree(list);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(gnssposget_stats);
+
+/*----------------------------------------
+     Line discipline
+/*----------------------------------------*/
 static int gnssposget_open(struct tty_struct *tty)
 {
     struct n_gnssposget *n_gnssposget = tty->disc_data;
@@ -68,15 +553,30 @@ static int gnssposget_open(struct tty_struct *tty)
         return -ENOMEM;
     }
 
-    n_gnssposget->nmea_temp.partial_read = false;
+    /* Each tty owns its ring */
+    n_gnssposget->ring = gnssposget_ring_alloc(ring_size);
+    if (!n_gnssposget->ring) {
+        PDEBUG("Failed to allocate %u bytes receive ring\n", ring_size);
+        kfree(nmeatxt);
+        kfree(n_gnssposget);
+        return -ENOMEM;
+    }
+
+    n_gnssposget->tty = tty;
     n_gnssposget->nmeatxt = nmeatxt;
+    gnssposget_filter_default(n_gnssposget);
     mutex_init(&n_gnssposget->mutex_lock);
-    init_waitqueue_head(&n_gnssposget->read_queue);
+    mutex_init(&n_gnssposget->write_lock);
+    init_waitqueue_head(&n_gnssposget->ack_wait);
+    spin_lock_init(&n_gnssposget->lock);
     tty->disc_data = n_gnssposget;
     tty->receive_room = 128;
 
+    /* Statistics are optional, a failure here leaves them out */
+    n_gnssposget->debugfs = debugfs_create_file(tty->name, S_IRUGO, gnssposget_debugfs,
+                                                n_gnssposget, &gnssposget_stats_fops);
+
     tty_driver_flush_buffer(tty);
-    kfifo_reset(&nmea_kfifo); /* Make sure kfifo is empty*/
 
     spin_lock_irqsave(&n_gnssposget->lock, flags);
 	set_bit(GNSSPOSGET_ACTIVE, &n_gnssposget->flags);
@@ -90,186 +590,1176 @@ static void gnssposget_close(struct tty_struct *tty)
 	struct n_gnssposget *n_gnssposget = tty->disc_data;
 	unsigned long flags;
 
-    kfifo_reset(&nmea_kfifo);
-
-    mutex_destroy(&n_gnssposget->mutex_lock);
-    kfree(n_gnssposget);
+    if (!n_gnssposget)
+        return;
 
     spin_lock_irqsave(&n_gnssposget->lock, flags);
 	clear_bit(GNSSPOSGET_ACTIVE, &n_gnssposget->flags);
 	spin_unlock_irqrestore(&n_gnssposget->lock, flags);
 
+    tty->disc_data = NULL;
+
+    /* Waits for readers of the statistics file */
+    debugfs_remove(n_gnssposget->debugfs);
+
+    /* Ring file descriptors may outlive us. Let their waiters go */
+    WRITE_ONCE(n_gnssposget->ring->dead, true);
+    wake_up_interruptible(&n_gnssposget->ring->wait);
+    kref_put(&n_gnssposget->ring->ref, gnssposget_ring_free);
+
+    mutex_destroy(&n_gnssposget->mutex_lock);
+    mutex_destroy(&n_gnssposget->write_lock);
+    kfree(n_gnssposget->nmeatxt);
+    kfree(n_gnssposget);
+
 	PDEBUG("%s() called (device=%s)\n", __func__, tty->name);
 }
 
+/*
+ * Cursor of @file, set up on its first read() or poll() to start with
+ * what is still queued. The line discipline isn't told when files are
+ * closed, so once all slots are taken the least recently used one is
+ * handed over. Slots are matched by file and by the generation stored
+ * in its f_version, a struct file reused for a new open doesn't pick up
+ * the position of the closed one. A file that lost its slot carries on
+ * with new data and has one overrun counted instead of getting again
+ * what it already read. Called with mutex_lock held.
+ */
+static struct gnssposget_cursor *gnssposget_reader_cursor(struct n_gnssposget *n_gnssposget,
+                                                          struct file *file)
+{
+    struct gnssposget_reader *reader, *lru = NULL;
+    u32 tail;
+    int i;
+
+    for (i = 0; i < READERS_MAX; i++) {
+        reader = &n_gnssposget->readers[i];
+        if (reader->file == file) {
+            if (reader->gen == file->f_version) {
+                reader->last_used = jiffies;
+                return &reader->cur;
+            }
+
+            /* Left behind by a closed file at the same address */
+            reader->file = NULL;
+        }
+
+        /* Free slot first, otherwise the one idle for longest */
+        if (!lru || (lru->file && (!reader->file || time_before(reader->last_used, lru->last_used))))
+            lru = reader;
+    }
+
+    if (lru->file)
+        PDEBUG("All %d reader slots taken, reusing the least recently used\n", READERS_MAX);
+
+    memset(&lru->cur, 0, sizeof(struct gnssposget_cursor));
+    if (file->f_version != 0) {
+        lru->cur.pos = smp_load_acquire(&n_gnssposget->ring->hdr->head);
+        lru->cur.lost = 1;
+    } else {
+        tail = READ_ONCE(n_gnssposget->ring->hdr->tail);
+        lru->cur.pos = ((s32)(n_gnssposget->read_start - tail) > 0) ? n_gnssposget->read_start : tail;
+    }
+
+    file->f_version = ++n_gnssposget->reader_gen;
+    lru->file = file;
+    lru->gen = file->f_version;
+    lru->last_used = jiffies;
+
+    return &lru->cur;
+}
+
+/* Stop waiting in read(): data arrived, or the tty is going away or changing discipline */
+static bool gnssposget_read_ready(struct tty_struct *tty, struct file *file,
+                                  struct n_gnssposget *n_gnssposget,
+                                  struct gnssposget_cursor *cur)
+{
+    return gnssposget_cursor_pending(n_gnssposget->ring, cur) ||
+           test_bit(TTY_OTHER_CLOSED, &tty->flags) ||
+           test_bit(TTY_LDISC_CHANGING, &tty->flags) ||
+           tty_hung_up_p(file);
+}
+
+/*
+ * Space left in the caller's buffer, counted from this call's @nr bytes.
+ * The tty core only says when less than a chunk is left, otherwise the
+ * size the reader's buffer had when it was last filled is assumed.
+ */
+static size_t gnssposget_read_room(struct gnssposget_cursor *cur, size_t nr,
+                                   unsigned long offset)
+{
+    if (nr < GNSSPOSGET_READ_CHUNK)
+        return nr;
+
+    if (cur->room > (offset + nr))
+        return cur->room - offset;
+
+    return SIZE_MAX;
+}
+
+/*
+ * Copies as many whole queued sentences as fit into the caller's buffer.
+ * Every file has its own position, readers don't take sentences
+ * from each other and a slow one only loses its own oldest data.
+ *
+ * The tty core hands us at most GNSSPOSGET_READ_CHUNK bytes per call.
+ * While @cookie is set it keeps calling back with the rest of the user
+ * buffer, so one read() drains a whole epoch. A record that doesn't fit
+ * in what is left of the buffer waits for the next read(), -EOVERFLOW
+ * tells that one doesn't fit at all. The size of the buffer is only
+ * known once a read() filled it, so the first full read() of a file, or
+ * one with a smaller buffer than before, can still split a record.
+ * Sentences are NUL terminated, in GNSSPOSGET_MODE_TEXT_TS each one
+ * follows its record header carrying the arrival time.
+ *
+ * With nothing queued returns -EAGAIN for O_NONBLOCK readers, otherwise
+ * sleeps until data arrives. Returns 0 once the tty is hung up.
+ */
 ssize_t	gnssposget_read(struct tty_struct *tty, struct file *file,
 			unsigned char *buf, size_t nr,
             void **cookie, unsigned long offset)
 {
     struct n_gnssposget *n_gnssposget = tty->disc_data;
-    int ret = 0;
+    struct gnssposget_cursor *cur = *cookie;
+    struct gnssposget_ring *ring;
+    size_t copied, room;
+    bool with_hdr, full;
+    u32 backlog;
 
     if (!n_gnssposget)
        return -ENODEV;
 
-    if (nr == 0) {
-        PDEBUG("Omitting request to read %d bytes");
-        return 0;
-    }
+    ring = n_gnssposget->ring;
+    if (cur == NULL) {
+        if (nr == 0) {
+            PDEBUG("Omitting request to read 0 bytes\n");
+            return 0;
+        }
 
-    /* Check if kfifo has data */
-    mutex_lock(&n_gnssposget->mutex_lock);
-    if (kfifo_len(&nmea_kfifo) == 0U) {
+        if (mutex_lock_interruptible(&n_gnssposget->mutex_lock))
+            return -ERESTARTSYS;
 
         /* Block until data is available */
-        mutex_unlock(&n_gnssposget->mutex_lock);
-        if (wait_event_interruptible(n_gnssposget->read_queue,
-                                    kfifo_len(&nmea_kfifo) > 0)) {
-            ret = -ERESTARTSYS;
-            goto unlock;
-        }
+        cur = gnssposget_reader_cursor(n_gnssposget, file);
+        while (!gnssposget_cursor_pending(ring, cur)) {
+            mutex_unlock(&n_gnssposget->mutex_lock);
+            if (test_bit(TTY_OTHER_CLOSED, &tty->flags) || tty_hung_up_p(file))
+                return 0;
 
-        mutex_lock(&n_gnssposget->mutex_lock);
-    }
+            if (tty_io_nonblock(tty, file))
+                return -EAGAIN;
 
-    /* We already pop'ed an element from kfifo is continuing a partial read */
-    if (n_gnssposget->nmea_temp.partial_read == false)
-    {
-        kfifo_get(&nmea_kfifo, &n_gnssposget->nmea_temp);
-    }
+            if (wait_event_interruptible(tty->read_wait,
+                                        gnssposget_read_ready(tty, file, n_gnssposget, cur)))
+                return -ERESTARTSYS;
 
-    /* Check if element length is longer that we can pass */
-    if (n_gnssposget->nmea_temp.len > nr)
-    {
-        n_gnssposget->nmea_temp.partial_read = true;
-    }
-    else
-    {
-        /* Rest of a buffer can be sent during this read */
-        n_gnssposget->nmea_temp.partial_read = false;
-        if (nr > n_gnssposget->nmea_temp.len)
-        {
-            nr = n_gnssposget->nmea_temp.len;
+            if (mutex_lock_interruptible(&n_gnssposget->mutex_lock))
+                return -ERESTARTSYS;
+
+            /* Slot may have been handed over while we slept */
+            cur = gnssposget_reader_cursor(n_gnssposget, file);
         }
+
+        backlog = MIN(smp_load_acquire(&ring->hdr->head) - cur->pos, ring->size);
+        n_gnssposget->read_backlog_max = max(n_gnssposget->read_backlog_max, backlog);
     }
 
-	memcpy((U8*)buf, (U8*)n_gnssposget->nmea_temp.buf, nr);
-    ret = nr;
+    /* mutex_lock is held here until we stop asking for another call */
+    with_hdr = (READ_ONCE(n_gnssposget->mode) == GNSSPOSGET_MODE_TEXT_TS);
+    if (nr < GNSSPOSGET_READ_CHUNK)
+        cur->room = offset + nr;
 
-    /* Move a rest of a buffer in front */
-    if (n_gnssposget->nmea_temp.partial_read == true)
-    {
-        n_gnssposget->nmea_temp.len -= ret;
-        (void)memmove((U8*)n_gnssposget->nmea_temp.buf, (U8*)&n_gnssposget->nmea_temp.buf[ret], n_gnssposget->nmea_temp.len);
+    room = gnssposget_read_room(cur, nr, offset);
+    copied = gnssposget_ring_read(ring, cur, buf, nr, with_hdr, room, &full);
+    if (full && ((offset + copied) == 0) && (room > nr)) {
+        /* Buffer may have grown since its size was taken, try it */
+        cur->room = 0;
+        copied = gnssposget_ring_read(ring, cur, buf, nr, with_hdr, SIZE_MAX, &full);
     }
 
+    n_gnssposget->read_lost += cur->lost;
+    cur->lost = 0;
+    trace_gnssposget_read(tty->name, cur->pos, nr, copied);
+
+    if ((nr != 0) && !full && gnssposget_cursor_pending(ring, cur)) {
+        /* Buffer full but more is queued. Ask to be called again */
+        *cookie = cur;
+        return copied;
+    }
 
-    unlock:
+    *cookie = NULL;
     mutex_unlock(&n_gnssposget->mutex_lock);
-    return ret;
+    if (full && ((offset + copied) == 0)) {
+        PDEBUG("Record doesn't fit in a %zu byte buffer\n", nr);
+        return -EOVERFLOW;
+    }
+
+    return copied;
 }
 
-static void handle_nmea(struct n_gnssposget *n_gnssposget)
+static __poll_t gnssposget_poll(struct tty_struct *tty, struct file *file,
+                                struct poll_table_struct *wait)
 {
-    /* Receive GPTXT, GPGSV & GPRMC only */
-	// PDEBUG("got NMEA: %s", n_gnssposget->nmeatxt->nmea_text);
-	if (n_gnssposget->nmeatxt->index >= NMEA_LEN) {
-	    if ((memcmp(n_gnssposget->nmeatxt->nmea_text, gptxt_prefix, NMEA_LEN) == 0) ||
-            (memcmp(n_gnssposget->nmeatxt->nmea_text, gprmc_prefix, NMEA_LEN) == 0) ||
-            (memcmp(n_gnssposget->nmeatxt->nmea_text, gpgsv_prefix, NMEA_LEN) == 0))
-        {
-            struct nmea_cbuf nmea;
-            if (n_gnssposget->nmeatxt->index > NMEA_MAX_LENGTH)
-            {
-                PDEBUG("WARNING!!! NMEA string is longer than receiving buffer!");
-            }
-
-            n_gnssposget->nmeatxt->nmea_text[n_gnssposget->nmeatxt->index++] = '\0';
-            memcpy((U8*)nmea.buf, (U8*)n_gnssposget->nmeatxt->nmea_text, n_gnssposget->nmeatxt->index);
-            nmea.len = n_gnssposget->nmeatxt->index;
-            nmea.partial_read = false;
-            if (kfifo_put(&nmea_kfifo, nmea) == 0)
-            {
-                PDEBUG("kfifo full! Dropping oldest element");
-                struct nmea_cbuf dummy;
-                kfifo_get(&nmea_kfifo, &dummy);
-                kfifo_put(&nmea_kfifo, nmea);
-            }
+    struct n_gnssposget *n_gnssposget = tty->disc_data;
+    __poll_t mask = 0;
 
-            wake_up_interruptible(&n_gnssposget->read_queue);
-        }
-	}
-}
+    if (!n_gnssposget)
+        return EPOLLERR;
 
+    poll_wait(file, &tty->read_wait, wait);
+    poll_wait(file, &tty->write_wait, wait);
 
-static void gnssposget_receive(struct tty_struct *tty,
-                           const U8 *cp,
-                           const char *fp,
-                           int count)
-{
-    struct n_gnssposget *n_gnssposget = tty->disc_data;
-	unsigned long flags;
-    int i = 0;
+    mutex_lock(&n_gnssposget->mutex_lock);
+    if (gnssposget_cursor_pending(n_gnssposget->ring, gnssposget_reader_cursor(n_gnssposget, file)))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    mutex_unlock(&n_gnssposget->mutex_lock);
 
-    if (!n_gnssposget) {
-        PDEBUG("No GNSS position getter available\n");
-        return;
-    }
+    if (tty_write_room(tty) > 0)
+        mask |= EPOLLOUT | EPOLLWRNORM;
 
-    if (!count) {
-        PDEBUG("No data to process\n");
-        return;
-    }
+    if (test_bit(TTY_OTHER_CLOSED, &tty->flags) || tty_hung_up_p(file))
+        mask |= EPOLLHUP;
 
-    for (i = 0; i < count; i++) {
-		U8 ch = cp[i];
+    return mask;
+}
 
-        /* Start a new frame when we see '$' */
-        spin_lock_irqsave(&n_gnssposget->lock, flags);
-		if (ch == '$') {
-			n_gnssposget->nmeatxt->valid_frame = true;
-			n_gnssposget->nmeatxt->index = 0;
-		}
+/* Switches what read() returns, readers start over with what arrives next */
+static int gnssposget_mode_set(struct n_gnssposget *n_gnssposget, u32 mode)
+{
+    unsigned long flags;
+    int i;
 
-        if (n_gnssposget->nmeatxt->valid_frame == false) {
-			goto unlock;
-        }
+    if ((mode != GNSSPOSGET_MODE_TEXT) && (mode != GNSSPOSGET_MODE_FIX) &&
+        (mode != GNSSPOSGET_MODE_TEXT_TS))
+        return -EINVAL;
 
-        /* Append byte with overflow guard */
-		if (n_gnssposget->nmeatxt->index < (NMEA_MAX_LENGTH - 1)) {
-            n_gnssposget->nmeatxt->nmea_text[n_gnssposget->nmeatxt->index++] = ch;
-		} else {
-			/* Too long; reset and wait for next '$' */
-            PDEBUG("Incorrect NMEA, too long");
-			n_gnssposget->nmeatxt->valid_frame = false;
-			n_gnssposget->nmeatxt->index = 0;
-			goto unlock;
-		}
+    if (mutex_lock_interruptible(&n_gnssposget->mutex_lock))
+        return -ERESTARTSYS;
 
-        /* End of line? NMEA lines end with \r\n (handle either) */
-		if (ch == '\n' || ch == '\r') {
-			handle_nmea(n_gnssposget);
-			n_gnssposget->nmeatxt->valid_frame = false;
-			n_gnssposget->nmeatxt->index = 0;
-		}
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    n_gnssposget->mode = mode;
+    memset(&n_gnssposget->gsv_pending, 0, sizeof(struct gnssposget_gsv));
+    memset(&n_gnssposget->gsv_last, 0, sizeof(struct gnssposget_gsv));
+    gnssposget_frame_reset(n_gnssposget, false);
+    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
 
-        unlock:
-	    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+    /* Don't hand out records of the previous mode */
+    n_gnssposget->read_start = smp_load_acquire(&n_gnssposget->ring->hdr->head);
+    for (i = 0; i < READERS_MAX; i++) {
+        memset(&n_gnssposget->readers[i].cur, 0, sizeof(struct gnssposget_cursor));
+        n_gnssposget->readers[i].cur.pos = n_gnssposget->read_start;
     }
+    mutex_unlock(&n_gnssposget->mutex_lock);
+    return 0;
 }
 
-static struct tty_ldisc_ops n_gnssposget_ldisc = {
-    /* from above */
-    .owner        = THIS_MODULE,
-    .num          = N_GNSSPOSGET,
-    .name         = "n_gnssposget",
+/* Replaces the accepted addresses, the old list stays if @list is invalid */
+static int gnssposget_filter_set(struct n_gnssposget *n_gnssposget,
+                                 const struct gnssposget_filter *list)
+{
+    u32 table[FILTER_SLOTS];
+    u8 index[FILTER_SLOTS];
+    unsigned long flags;
+    int ret;
+
+    ret = gnssposget_filter_build(list, table, index);
+    if (ret != 0)
+        return ret;
+
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    n_gnssposget->filter_list = *list;
+    memcpy(n_gnssposget->filter, table, sizeof(table));
+    memcpy(n_gnssposget->filter_index, index, sizeof(index));
+    /* Per address counts belong to the old list */
+    memset(n_gnssposget->stats.accepted_by_addr, 0,
+           sizeof(n_gnssposget->stats.accepted_by_addr));
+    memset(n_gnssposget->stats.filtered_by_addr, 0,
+           sizeof(n_gnssposget->stats.filtered_by_addr));
+    memset(n_gnssposget->stats.filtered_addr, 0,
+           sizeof(n_gnssposget->stats.filtered_addr));
+    n_gnssposget->nmeatxt->filter_index = -1;
+    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+    return 0;
+}
+
+static int gnssposget_ioctl(struct tty_struct *tty, unsigned int cmd, unsigned long arg)
+{
+    struct n_gnssposget *n_gnssposget = tty->disc_data;
+    unsigned long flags;
+    u32 mode;
+    int fd;
+
+    if (!n_gnssposget)
+        return -ENODEV;
+
+    switch (cmd) {
+        case GNSSPOSGET_IOCSMODE:
+            if (get_user(mode, (__u32 __user *)arg))
+                return -EFAULT;
+
+            return gnssposget_mode_set(n_gnssposget, mode);
+
+        case GNSSPOSGET_IOCGMODE:
+            return put_user(n_gnssposget->mode, (__u32 __user *)arg);
+
+        case GNSSPOSGET_IOCSFILTER:
+        {
+            struct gnssposget_filter *list;
+            int ret;
+
+            list = memdup_user((void __user *)arg, sizeof(struct gnssposget_filter));
+            if (IS_ERR(list))
+                return PTR_ERR(list);
+
+            ret = gnssposget_filter_set(n_gnssposget, list);
+            kfree(list);
+            return ret;
+        }
+
+        case GNSSPOSGET_IOCGFILTER:
+        {
+            struct gnssposget_filter *list;
+            int ret = 0;
+
+            list = kmalloc(sizeof(struct gnssposget_filter), GFP_KERNEL);
+            if (!list)
+                return -ENOMEM;
+
+            spin_lock_irqsave(&n_gnssposget->lock, flags);
+            *list = n_gnssposget->filter_list;
+            spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+
+            if (copy_to_user((void __user *)arg, list, sizeof(struct gnssposget_filter)))
+                ret = -EFAULT;
+
+            kfree(list);
+            return ret;
+        }
+
+        case GNSSPOSGET_IOCGSTATS:
+        {
+            struct gnssposget_stats *stats;
+            int ret = 0;
+
+            stats = kmalloc(sizeof(struct gnssposget_stats), GFP_KERNEL);
+            if (!stats)
+                return -ENOMEM;
+
+            gnssposget_stats_get(n_gnssposget, stats);
+            if (copy_to_user((void __user *)arg, stats, sizeof(struct gnssposget_stats)))
+                ret = -EFAULT;
+
+            kfree(stats);
+            return ret;
+        }
+
+        case GNSSPOSGET_IOCGACK:
+        {
+            struct gnssposget_ack ack;
+
+            spin_lock_irqsave(&n_gnssposget->lock, flags);
+            ack = n_gnssposget->ack;
+            spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+
+            return copy_to_user((void __user *)arg, &ack, sizeof(ack)) ? -EFAULT : 0;
+        }
+
+        case GNSSPOSGET_IOCGRINGFD:
+            kref_get(&n_gnssposget->ring->ref);
+            fd = anon_inode_getfd("[gnssposget-ring]", &gnssposget_ring_fops,
+                                  n_gnssposget->ring, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                kref_put(&n_gnssposget->ring->ref, gnssposget_ring_free);
+
+            return fd;
+
+        default:
+            /* termios and friends */
+            return n_tty_ioctl_helper(tty, cmd, arg);
+    }
+}
+
+/*----------------------------------------
+     NMEA decoding (GNSSPOSGET_MODE_FIX)
+/*----------------------------------------*/
+#define NMEA_MAX_FIELDS         (24)
+#define RMC_FIELD_TIME          (1)
+#define RMC_FIELD_STATUS        (2)
+#define RMC_FIELD_SPEED_K       (7)
+#define RMC_FIELD_DATE          (9)
+#define GSV_FIELD_MSG_NR        (2)
+#define GSV_FIELD_SAT_COUNT     (3)
+#define GSV_FIELD_FIRST_SNR     (7)
+#define GSV_FIELDS_PER_SAT      (4)
+
+struct nmea_fields {
+    const U8 *start[NMEA_MAX_FIELDS];
+    u8 len[NMEA_MAX_FIELDS];
+    int count;
+};
+
+/* Checks the *hh checksum: XOR of everything between '$' and '*' */
+static bool nmea_checksum_ok(const U8 *text, int len)
+{
+    U8 sum = 0;
+    int hi, lo;
+    int i;
+
+    for (i = 1; i < len; i++) {
+        if (text[i] == '*')
+            break;
+        sum ^= text[i];
+    }
+
+    if ((i + 2) >= len)
+        return false;
+
+    hi = hex_to_bin(text[i + 1]);
+    lo = hex_to_bin(text[i + 2]);
+    return (hi >= 0) && (lo >= 0) && (sum == ((hi << 4) | lo));
+}
+
+/* Splits sentence into comma separated fields, stops at the checksum */
+static void nmea_split(const U8 *text, int len, struct nmea_fields *fields)
+{
+    int i, start = 0;
+
+    fields->count = 0;
+    for (i = 0; (i <= len) && (fields->count < NMEA_MAX_FIELDS); i++) {
+        if ((i == len) || (text[i] == ',') || (text[i] == '*') || (text[i] == '\r')) {
+            fields->start[fields->count] = &text[start];
+            fields->len[fields->count] = i - start;
+            fields->count++;
+            start = i + 1;
+            if ((i == len) || (text[i] != ','))
+                break;
+        }
+    }
+}
+
+/* Decimal "ddd.ddd" to fixed point with @decimals fractional digits */
+static bool nmea_to_fixed(const U8 *s, int len, int decimals, u32 *out)
+{
+    u32 val = 0;
+    int frac = -1;
+    int i;
+
+    if (len == 0)
+        return false;
+
+    for (i = 0; i < len; i++) {
+        if (s[i] == '.') {
+            if (frac >= 0)
+                return false;
+            frac = 0;
+            continue;
+        }
+
+        if (!isdigit(s[i]))
+            return false;
+
+        if (frac >= 0) {
+            if (frac == decimals)
+                continue; /* Precision we don't need */
+            frac++;
+        }
+
+        val = val * 10 + (s[i] - '0');
+    }
+
+    for (frac = max(frac, 0); frac < decimals; frac++)
+        val *= 10;
+
+    *out = val;
+    return true;
+}
+
+/* "hhmmss.sss" to milliseconds since midnight */
+static bool nmea_utc_to_ms(const U8 *s, int len, u32 *out)
+{
+    u32 hh, mm, ms;
+
+    if ((len < 6) ||
+        !nmea_to_fixed(&s[0], 2, 0, &hh) ||
+        !nmea_to_fixed(&s[2], 2, 0, &mm) ||
+        !nmea_to_fixed(&s[4], len - 4, 3, &ms))
+        return false;
+
+    *out = (hh * 3600000U) + (mm * 60000U) + ms;
+    return true;
+}
+
+static void nmea_decode_gsv(struct n_gnssposget *n_gnssposget, struct nmea_fields *fields)
+{
+    struct gnssposget_gsv *gsv = &n_gnssposget->gsv_pending;
+    u32 msg_nr, value;
+    int i;
+
+    if (fields->count <= GSV_FIELD_SAT_COUNT)
+        return;
+
+    if (!nmea_to_fixed(fields->start[GSV_FIELD_MSG_NR], fields->len[GSV_FIELD_MSG_NR], 0, &msg_nr))
+        return;
+
+    /* Satellites in view is repeated in every part. Count it once per talker */
+    if ((msg_nr == 1) &&
+        nmea_to_fixed(fields->start[GSV_FIELD_SAT_COUNT], fields->len[GSV_FIELD_SAT_COUNT], 0, &value)) {
+        gsv->sats_in_view = min_t(u32, gsv->sats_in_view + value, U8_MAX);
+        gsv->valid = true;
+    }
+
+    for (i = GSV_FIELD_FIRST_SNR; i < fields->count; i += GSV_FIELDS_PER_SAT) {
+        if (!nmea_to_fixed(fields->start[i], fields->len[i], 0, &value))
+            continue; /* Satellite not tracked */
+
+        gsv->snr_count = min_t(u32, gsv->snr_count + 1, U8_MAX);
+        gsv->snr_sum += value;
+        gsv->snr_max = max_t(u32, gsv->snr_max, min_t(u32, value, U8_MAX));
+    }
+}
+
+/* Adds what the GSV sentences of the previous epoch reported */
+static void gnssposget_fix_add_gsv(struct n_gnssposget *n_gnssposget, struct gnssposget_fix *fix)
+{
+    struct gnssposget_gsv *gsv = &n_gnssposget->gsv_last;
+
+    /* GSV sentences of the previous epoch are complete by now */
+    if (n_gnssposget->gsv_pending.valid) {
+        *gsv = n_gnssposget->gsv_pending;
+        memset(&n_gnssposget->gsv_pending, 0, sizeof(struct gnssposget_gsv));
+    }
+
+    if (gsv->valid) {
+        fix->flags |= GNSSPOSGET_FIX_SATS_VALID;
+        fix->sats_in_view = gsv->sats_in_view;
+        fix->snr_count = gsv->snr_count;
+        fix->snr_max = gsv->snr_max;
+        fix->snr_mean = gsv->snr_count ? (gsv->snr_sum / gsv->snr_count) : 0;
+    }
+}
+
+static void nmea_decode_rmc(struct n_gnssposget *n_gnssposget, struct nmea_fields *fields,
+                            struct gnssposget_fix *fix)
+{
+    u32 mknots;
+
+    memset(fix, 0, sizeof(*fix));
+    fix->arrival_ns = ktime_to_ns(n_gnssposget->nmeatxt->stamp);
+
+    if (fields->count <= RMC_FIELD_DATE)
+        return;
+
+    if (nmea_utc_to_ms(fields->start[RMC_FIELD_TIME], fields->len[RMC_FIELD_TIME], &fix->utc_ms))
+        fix->flags |= GNSSPOSGET_FIX_TIME_VALID;
+
+    if (nmea_to_fixed(fields->start[RMC_FIELD_SPEED_K], fields->len[RMC_FIELD_SPEED_K], 3, &mknots)) {
+        /* 1 knot = 1852 m/h */
+        fix->speed_mmps = (u32)div_u64((u64)mknots * 1852U, 3600U);
+        fix->flags |= GNSSPOSGET_FIX_SPEED_VALID;
+    }
+
+    if (nmea_to_fixed(fields->start[RMC_FIELD_DATE], fields->len[RMC_FIELD_DATE], 0, &fix->date))
+        fix->flags |= GNSSPOSGET_FIX_DATE_VALID;
+
+    if (fields->len[RMC_FIELD_STATUS] == 1) {
+        fix->status = fields->start[RMC_FIELD_STATUS][0];
+        /* A=Autonomous GNSS Fix, D=Differential GNSS Fix */
+        if ((fix->status == 'A') || (fix->status == 'D'))
+            fix->flags |= GNSSPOSGET_FIX_VALID;
+    }
+
+    gnssposget_fix_add_gsv(n_gnssposget, fix);
+}
+
+/*
+ * Replaces the sentence being assembled with its decoded fix record.
+ * Returns false if the sentence was corrupted.
+ */
+static bool handle_nmea_fix(struct n_gnssposget *n_gnssposget)
+{
+    U8 *text = gnssposget_frame_text(n_gnssposget);
+    int len = n_gnssposget->nmeatxt->index;
+    struct nmea_fields fields;
+    struct gnssposget_fix fix;
+
+    if (!nmea_checksum_ok(text, len)) {
+        PDEBUG("NMEA checksum mismatch\n");
+        n_gnssposget->stats.bad_checksum++;
+        return false;
+    }
+
+    nmea_split(text, len, &fields);
+
+    /* Type is what follows the two character talker ID */
+    if (memcmp(&text[3], "GSV", 3) == 0) {
+        nmea_decode_gsv(n_gnssposget, &fields);
+    } else if (memcmp(&text[3], "RMC", 3) == 0) {
+        nmea_decode_rmc(n_gnssposget, &fields, &fix);
+        n_gnssposget->nmeatxt->index = 0;
+        gnssposget_frame_append(n_gnssposget, (const U8 *)&fix, sizeof(fix));
+        gnssposget_frame_commit(n_gnssposget, GNSSPOSGET_REC_FIX);
+    }
+
+    return true;
+}
+
+/* Complete sentence that passed the filter */
+static void handle_nmea(struct n_gnssposget *n_gnssposget)
+{
+    struct gnssposget_ring_hdr *hdr = n_gnssposget->ring->hdr;
+    int filter_index = n_gnssposget->nmeatxt->filter_index;
+
+    trace_gnssposget_nmea(n_gnssposget->tty->name, gnssposget_frame_text(n_gnssposget),
+                          n_gnssposget->nmeatxt->index, ktime_to_ns(n_gnssposget->nmeatxt->stamp),
+                          hdr->head - hdr->tail);
+
+    if (n_gnssposget->mode == GNSSPOSGET_MODE_FIX) {
+        if (!handle_nmea_fix(n_gnssposget))
+            return;
+    } else {
+        gnssposget_frame_append(n_gnssposget, (const U8 *)"", 1);
+        gnssposget_frame_commit(n_gnssposget, GNSSPOSGET_REC_NMEA);
+    }
+
+    n_gnssposget->stats.accepted++;
+    if (filter_index >= 0)
+        n_gnssposget->stats.accepted_by_addr[filter_index]++;
+}
+
+/*----------------------------------------
+     UBX protocol
+/*----------------------------------------*/
+#define UBX_SYNC_1              (0xB5)
+#define UBX_SYNC_2              (0x62)
+/* Sync characters, class, ID and little endian payload length */
+#define UBX_HDR_LEN             (6)
+#define UBX_CK_LEN              (2)
+#define UBX_CLASS_NAV           (0x01)
+#define UBX_CLASS_ACK           (0x05)
+#define UBX_CLASS_CFG           (0x06)
+#define UBX_ACK_NAK             (0x00)
+#define UBX_ACK_ACK             (0x01)
+#define UBX_ACK_LEN             (2)
+#define UBX_NAV_PVT             (0x07)
+#define UBX_NAV_PVT_LEN         (92)
+#define PVT_VALID_DATE          BIT(0)
+#define PVT_VALID_TIME          BIT(1)
+#define PVT_FLAGS_FIX_OK        BIT(0)
+#define PVT_FIX_2D              (2)
+#define PVT_FIX_GNSS_DR         (4)
+
+/* 8-bit Fletcher checksum over class, ID, length and payload */
+static bool ubx_checksum_ok(const U8 *frame, int len)
+{
+    U8 ck_a = 0, ck_b = 0;
+    int i;
+
+    for (i = 2; i < (len - UBX_CK_LEN); i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+
+    return (frame[len - 2] == ck_a) && (frame[len - 1] == ck_b);
+}
+
+static void ubx_decode_nav_pvt(struct n_gnssposget *n_gnssposget, const U8 *pvt,
+                               struct gnssposget_fix *fix)
+{
+    s32 gspeed = (s32)get_unaligned_le32(&pvt[60]);
+    s32 nano = (s32)get_unaligned_le32(&pvt[16]);
+    s32 ms;
+
+    memset(fix, 0, sizeof(*fix));
+    fix->arrival_ns = ktime_to_ns(n_gnssposget->nmeatxt->stamp);
+    fix->fix_type = pvt[20];
+    fix->sats_used = pvt[23];
+
+    if (pvt[11] & PVT_VALID_TIME) {
+        /* nano is a signed correction to the rounded second */
+        ms = ((pvt[8] * 3600) + (pvt[9] * 60) + pvt[10]) * 1000 + (nano / 1000000);
+        fix->utc_ms = (ms < 0) ? (ms + 86400000) : ms;
+        fix->flags |= GNSSPOSGET_FIX_TIME_VALID;
+    }
+
+    if (pvt[11] & PVT_VALID_DATE) {
+        fix->date = (pvt[7] * 10000U) + (pvt[6] * 100U) + (get_unaligned_le16(&pvt[4]) % 100U);
+        fix->flags |= GNSSPOSGET_FIX_DATE_VALID;
+    }
+
+    if ((pvt[21] & PVT_FLAGS_FIX_OK) &&
+        (fix->fix_type >= PVT_FIX_2D) && (fix->fix_type <= PVT_FIX_GNSS_DR)) {
+        fix->status = 'A';
+        fix->flags |= GNSSPOSGET_FIX_VALID;
+        if (gspeed >= 0) {
+            fix->speed_mmps = gspeed;
+            fix->speed_acc_mmps = get_unaligned_le32(&pvt[68]);
+            fix->flags |= GNSSPOSGET_FIX_SPEED_VALID | GNSSPOSGET_FIX_SPEED_ACC_VALID;
+        }
+    } else {
+        fix->status = 'V';
+    }
+
+    gnssposget_fix_add_gsv(n_gnssposget, fix);
+}
+
+/* Settles the pending command an ACK-ACK or ACK-NAK refers to */
+static void ubx_ack_received(struct n_gnssposget *n_gnssposget, bool acked, U8 cls, U8 id)
+{
+    struct gnssposget_ack *ack = &n_gnssposget->ack;
+
+    if ((ack->status != GNSSPOSGET_ACK_PENDING) || (ack->cls != cls) || (ack->id != id)) {
+        PDEBUG("Unexpected UBX ACK for %02x %02x\n", cls, id);
+        return;
+    }
+
+    WRITE_ONCE(ack->status, acked ? GNSSPOSGET_ACK_ACK : GNSSPOSGET_ACK_NAK);
+    wake_up_interruptible(&n_gnssposget->ack_wait);
+}
+
+/* Complete UBX frame */
+static void handle_ubx(struct n_gnssposget *n_gnssposget)
+{
+    U8 *frame = gnssposget_frame_text(n_gnssposget);
+    int len = n_gnssposget->nmeatxt->index;
+    struct gnssposget_fix fix;
+
+    if (!ubx_checksum_ok(frame, len)) {
+        PDEBUG("UBX checksum mismatch\n");
+        n_gnssposget->stats.ubx_bad_checksum++;
+        return;
+    }
+
+    n_gnssposget->stats.ubx_accepted++;
+
+    if ((frame[2] == UBX_CLASS_ACK) && (len == (UBX_HDR_LEN + UBX_ACK_LEN + UBX_CK_LEN)))
+        ubx_ack_received(n_gnssposget, frame[3] == UBX_ACK_ACK,
+                         frame[UBX_HDR_LEN], frame[UBX_HDR_LEN + 1]);
+
+    switch (n_gnssposget->mode) {
+        case GNSSPOSGET_MODE_FIX:
+            if ((frame[2] == UBX_CLASS_NAV) && (frame[3] == UBX_NAV_PVT) &&
+                (len == (UBX_HDR_LEN + UBX_NAV_PVT_LEN + UBX_CK_LEN))) {
+                ubx_decode_nav_pvt(n_gnssposget, &frame[UBX_HDR_LEN], &fix);
+                n_gnssposget->nmeatxt->index = 0;
+                gnssposget_frame_append(n_gnssposget, (const U8 *)&fix, sizeof(fix));
+                gnssposget_frame_commit(n_gnssposget, GNSSPOSGET_REC_FIX);
+            }
+            break;
+
+        case GNSSPOSGET_MODE_TEXT_TS:
+            gnssposget_frame_commit(n_gnssposget, GNSSPOSGET_REC_UBX);
+            break;
+
+        default:
+            /* Text readers only know NUL terminated sentences */
+            break;
+    }
+}
+
+/* One complete UBX frame, nothing more */
+static bool ubx_frame_ok(const U8 *buf, size_t nr)
+{
+    if ((nr < (UBX_HDR_LEN + UBX_CK_LEN)) || (buf[0] != UBX_SYNC_1) || (buf[1] != UBX_SYNC_2))
+        return false;
+
+    if ((UBX_HDR_LEN + get_unaligned_le16(&buf[4]) + UBX_CK_LEN) != nr)
+        return false;
+
+    return ubx_checksum_ok(buf, nr);
+}
+
+/* Hands the whole frame to the tty driver, waiting for room if it has to */
+static int gnssposget_write_frame(struct tty_struct *tty, struct file *file,
+                                  const U8 *buf, size_t nr)
+{
+    int written;
+
+    while (nr > 0) {
+        written = tty->ops->write(tty, buf, nr);
+        if (written < 0)
+            return written;
+
+        buf += written;
+        nr -= written;
+        if (nr == 0)
+            break;
+
+        /* Even O_NONBLOCK writers wait here, half a frame would confuse the receiver */
+        if (wait_event_interruptible(tty->write_wait,
+                                     (tty_write_room(tty) > 0) || tty_hung_up_p(file)))
+            return -ERESTARTSYS;
+
+        if (tty_hung_up_p(file))
+            return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Sends one UBX command. CFG commands are acknowledged by the receiver,
+ * blocking writers wait for that and get ACK-NAK or no answer as an error.
+ */
+static ssize_t gnssposget_write(struct tty_struct *tty, struct file *file,
+                                const unsigned char *buf, size_t nr)
+{
+    struct n_gnssposget *n_gnssposget = tty->disc_data;
+    struct gnssposget_ack *ack;
+    unsigned long flags;
+    bool needs_ack;
+    long timeout;
+    int ret;
+
+    if (!n_gnssposget)
+        return -ENODEV;
+
+    if (!ubx_frame_ok(buf, nr)) {
+        PDEBUG("write() of %zu bytes is not a UBX frame\n", nr);
+        return -EINVAL;
+    }
+
+    if (mutex_lock_interruptible(&n_gnssposget->write_lock))
+        return -ERESTARTSYS;
+
+    ack = &n_gnssposget->ack;
+    needs_ack = (buf[2] == UBX_CLASS_CFG);
+
+    /* Armed before sending, the answer can be quicker than we are */
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    ack->cls = buf[2];
+    ack->id = buf[3];
+    ack->status = needs_ack ? GNSSPOSGET_ACK_PENDING : GNSSPOSGET_ACK_NONE;
+    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+
+    ret = gnssposget_write_frame(tty, file, buf, nr);
+    if ((ret != 0) || !needs_ack || tty_io_nonblock(tty, file))
+        goto out;
+
+    timeout = wait_event_interruptible_timeout(n_gnssposget->ack_wait,
+                                               READ_ONCE(ack->status) != GNSSPOSGET_ACK_PENDING,
+                                               msecs_to_jiffies(ack_timeout_ms));
+    if (timeout < 0) {
+        ret = timeout;
+        goto out;
+    }
+
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    if (ack->status == GNSSPOSGET_ACK_PENDING)
+        ack->status = GNSSPOSGET_ACK_TIMEOUT;
+
+    if (ack->status == GNSSPOSGET_ACK_NAK)
+        ret = -EREMOTEIO;
+    else if (ack->status == GNSSPOSGET_ACK_TIMEOUT)
+        ret = -ETIMEDOUT;
+    spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+
+out:
+    mutex_unlock(&n_gnssposget->write_lock);
+    return (ret != 0) ? ret : nr;
+}
+
+/*
+ * Takes UBX frame bytes: the header one byte at a time, held back until
+ * its length was checked, then payload and checksum in runs.
+ * Returns number of bytes consumed.
+ */
+static int ubx_receive_run(struct n_gnssposget *n_gnssposget, const U8 *cp, int count)
+{
+    struct nmea_container *frame = n_gnssposget->nmeatxt;
+    u32 payload;
+    int len;
+
+    if (frame->ubx_left == 0) {
+        if ((frame->index == 1) && (cp[0] != UBX_SYNC_2)) {
+            /* Stray 0xB5, this byte may start the next frame */
+            gnssposget_frame_reset(n_gnssposget, false);
+            return 0;
+        }
+
+        frame->buf[frame->index++] = cp[0];
+        if (frame->index < UBX_HDR_LEN)
+            return 1;
+
+        payload = get_unaligned_le16(&frame->buf[4]);
+        if (payload > UBX_MAX_PAYLOAD) {
+            PDEBUG("UBX payload of %u bytes too long\n", payload);
+            n_gnssposget->stats.ubx_oversized++;
+            gnssposget_frame_reset(n_gnssposget, false);
+            return 1;
+        }
+
+        frame->ubx_left = payload + UBX_CK_LEN;
+        return 1;
+    }
+
+    len = MIN((u32)count, frame->ubx_left);
+    gnssposget_frame_append(n_gnssposget, cp, len);
+    frame->ubx_left -= len;
+    if (frame->ubx_left == 0) {
+        handle_ubx(n_gnssposget);
+        gnssposget_frame_reset(n_gnssposget, false);
+    }
+
+    return len;
+}
+
+/*
+ * Counts a sentence the filter dropped, under its address while there is
+ * room in filtered_addr. Line noise that isn't an address only counts in
+ * the total, it would fill the table at a wrong baudrate.
+ */
+static void gnssposget_stats_filtered(struct gnssposget_stats *stats, const U8 *addr)
+{
+    int i;
+
+    stats->filtered++;
+    if (!nmea_addr_key(addr))
+        return;
+
+    for (i = 0; i < GNSSPOSGET_FILTERED_MAX; i++) {
+        if (!stats->filtered_addr[i][0]) {
+            memcpy(stats->filtered_addr[i], addr, GNSSPOSGET_ADDR_LEN);
+            stats->filtered_by_addr[i] = 1;
+            return;
+        }
+
+        if (memcmp(stats->filtered_addr[i], addr, GNSSPOSGET_ADDR_LEN) == 0) {
+            stats->filtered_by_addr[i]++;
+            return;
+        }
+    }
+}
+
+/*
+ * Checks the address against the filter once it is complete, so
+ * unwanted sentences are dropped early. Returns false to drop the frame.
+ */
+static bool gnssposget_frame_address(struct n_gnssposget *n_gnssposget, U8 ch)
+{
+    struct nmea_container *frame = n_gnssposget->nmeatxt;
+
+    frame->buf[frame->index++] = ch;
+    if (frame->index < NMEA_LEN)
+        return true;
+
+    frame->filter_index = gnssposget_filter_match(n_gnssposget, &frame->buf[1]);
+    if (frame->filter_index < 0) {
+        PDEBUG("Filtered out NMEA %.5s\n", (char *)&frame->buf[1]);
+        gnssposget_stats_filtered(&n_gnssposget->stats, &frame->buf[1]);
+        return false;
+    }
+
+    return true;
+}
+
+
+static inline bool frame_sync(U8 ch)
+{
+    return (ch == '$') || (ch == UBX_SYNC_1);
+}
+
+/* Starts a new NMEA frame at '$' or UBX frame at its first sync character */
+static void gnssposget_frame_start(struct n_gnssposget *n_gnssposget, U8 sync)
+{
+    gnssposget_frame_reset(n_gnssposget, true);
+    n_gnssposget->nmeatxt->ubx = (sync == UBX_SYNC_1);
+    n_gnssposget->nmeatxt->stamp = ktime_get();
+    n_gnssposget->nmeatxt->buf[n_gnssposget->nmeatxt->index++] = sync;
+}
+
+/* Length of the noise before the next frame start */
+static int frame_sync_len(const U8 *cp, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (frame_sync(cp[i]))
+            break;
+    }
+
+    return i;
+}
+
+/* Length of the run before the next line end or frame start */
+static int nmea_body_len(const U8 *cp, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if ((cp[i] == '\r') || (cp[i] == '\n') || frame_sync(cp[i]))
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * Takes as many bytes from @cp as belong to one step of the frame
+ * state machine and returns how many were consumed:
+ * noise up to the next '$' or UBX sync, one address byte, a whole run of
+ * sentence body up to and including its line end, or a step of a UBX frame.
+ */
+static int gnssposget_receive_run(struct n_gnssposget *n_gnssposget, const U8 *cp, int count)
+{
+    struct nmea_container *frame = n_gnssposget->nmeatxt;
+    int run, len;
+
+    if (!frame->valid_frame) {
+        /* Skip everything up to the next frame start */
+        run = frame_sync_len(cp, count);
+        if (run == count)
+            return count;
+
+        gnssposget_frame_start(n_gnssposget, cp[run]);
+        return run + 1;
+    }
+
+    if (frame->ubx)
+        return ubx_receive_run(n_gnssposget, cp, count);
+
+    if (frame->index < NMEA_LEN) {
+        if (frame_sync(cp[0])) {
+            n_gnssposget->stats.truncated++;
+            gnssposget_frame_start(n_gnssposget, cp[0]);
+        }
+        else if (!gnssposget_frame_address(n_gnssposget, cp[0]))
+            gnssposget_frame_reset(n_gnssposget, false);
+        return 1;
+    }
+
+    /* NMEA lines end with \r\n (handle either), '$' or UBX sync starts over */
+    run = nmea_body_len(cp, count);
+    len = run;
+    if ((run < count) && !frame_sync(cp[run]))
+        len++;
+
+    if ((frame->index + len) > (NMEA_MAX_LENGTH - 1)) {
+        /* Too long; reset and wait for next '$' */
+        PDEBUG("Incorrect NMEA, too long\n");
+        n_gnssposget->stats.overlong++;
+        gnssposget_frame_reset(n_gnssposget, false);
+        return run;
+    }
+
+    if (len)
+        gnssposget_frame_append(n_gnssposget, cp, len);
+
+    if (run == count)
+        return count; /* Sentence continues in the next chunk */
+
+    if (len > run)
+        handle_nmea(n_gnssposget);
+    else
+        n_gnssposget->stats.truncated++;
+
+    gnssposget_frame_reset(n_gnssposget, false);
+    return len;
+}
+
+/* Length of the run of bytes the tty driver received without error */
+static int tty_flags_clean_len(const char *fp, int count)
+{
+    int i;
+
+    if (!fp)
+        return count;
+
+    for (i = 0; i < count; i++) {
+        if (fp[i] != TTY_NORMAL)
+            break;
+    }
+
+    return i;
+}
+
+/* A byte arrived broken. Whatever frame it belongs to can't be trusted */
+static void gnssposget_receive_error(struct n_gnssposget *n_gnssposget, char flag)
+{
+    switch (flag) {
+        case TTY_BREAK:
+            n_gnssposget->stats.breaks++;
+            break;
+        case TTY_FRAME:
+            n_gnssposget->stats.framing++;
+            break;
+        case TTY_PARITY:
+            n_gnssposget->stats.parity++;
+            break;
+        case TTY_OVERRUN:
+            n_gnssposget->stats.overruns++;
+            break;
+        default:
+            break;
+    }
+
+    if (n_gnssposget->nmeatxt->valid_frame) {
+        PDEBUG("Dropping frame, tty error flag %d\n", flag);
+        n_gnssposget->stats.tty_errors++;
+        gnssposget_frame_reset(n_gnssposget, false);
+    }
+}
+
+static void gnssposget_receive(struct tty_struct *tty,
+                           const U8 *cp,
+                           const char *fp,
+                           int count)
+{
+    struct n_gnssposget *n_gnssposget = tty->disc_data;
+	unsigned long flags;
+    int consumed, clean;
+
+    if (!n_gnssposget) {
+        PDEBUG("No GNSS position getter available\n");
+        return;
+    }
+
+    if (!count) {
+        PDEBUG("No data to process\n");
+        return;
+    }
+
+    /* Readers are lockless, the lock only orders producers */
+    spin_lock_irqsave(&n_gnssposget->lock, flags);
+    trace_gnssposget_receive(tty->name, count, n_gnssposget->ring->hdr->head,
+                             n_gnssposget->ring->hdr->tail);
+    n_gnssposget->stats.rx_bytes += count;
+    while (count > 0) {
+        /* Flagged bytes are taken one at a time, clean ones in runs */
+        clean = tty_flags_clean_len(fp, count);
+        if (clean == 0) {
+            gnssposget_receive_error(n_gnssposget, fp[0]);
+            consumed = 1;
+        } else {
+            consumed = gnssposget_receive_run(n_gnssposget, cp, clean);
+        }
+
+        cp += consumed;
+        count -= consumed;
+        if (fp)
+            fp += consumed;
+    }
+	spin_unlock_irqrestore(&n_gnssposget->lock, flags);
+}
+
+static struct tty_ldisc_ops n_gnssposget_ldisc = {
+    /* from above */
+    .owner        = THIS_MODULE,
+    .num          = N_GNSSPOSGET,
+    .name         = "n_gnssposget",
     .read         = gnssposget_read,
+    .write        = gnssposget_write,
     .open         = gnssposget_open,
     .close        = gnssposget_close,
+    .ioctl        = gnssposget_ioctl,
+    .poll         = gnssposget_poll,
     /* from below */
     .receive_buf  = gnssposget_receive,
 };
 
+#ifdef GNSSPOSGET_KUNIT
+#include "gnssposget_kunit.c"
+#endif
+
 /*----------------------------------------
      Init/cleanup kernel module
 /*----------------------------------------*/
@@ -277,19 +1767,35 @@ static int __init n_gnssposget_init(void)
 {
     int result = 0;
 
+    /* Part of the userspace ABI */
+    BUILD_BUG_ON(sizeof(struct gnssposget_fix) != 64);
+
+    gnssposget_debugfs = debugfs_create_dir("gnssposget", NULL);
+
     result = tty_register_ldisc(&n_gnssposget_ldisc);
-    if (!result)
+    if (!result) {
         pr_info("N_GNSSPOSGET line discipline registered\n");
-    else
+    } else {
         pr_err("N_GNSSPOSGET: error registering line discipline: %d\n",
                 result);
+        debugfs_remove_recursive(gnssposget_debugfs);
+    }
+
+#ifdef GNSSPOSGET_KUNIT
+    if (!result)
+        gnssposget_kunit_init();
+#endif
 
     return result;
 }
 
 static void __exit n_gnssposget_exit(void)
 {
+#ifdef GNSSPOSGET_KUNIT
+    gnssposget_kunit_exit();
+#endif
     tty_unregister_ldisc(&n_gnssposget_ldisc);
+    debugfs_remove_recursive(gnssposget_debugfs);
 }
 
 
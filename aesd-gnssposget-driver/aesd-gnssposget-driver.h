@@ -6,7 +6,23 @@
 #endif
 
 #define NMEA_MAX_LENGTH 		(128)
-#define CIRC_BUFFER_SIZE	 	(16)
+/* Largest UBX payload we take, NAV-PVT has 92 bytes */
+#define UBX_MAX_PAYLOAD 		(512)
+/* Longest frame we assemble: UBX header, payload and checksum */
+#define FRAME_MAX	 		(6 + UBX_MAX_PAYLOAD + 2)
+/* Default receive ring capacity in bytes, see ring_size module parameter */
+#define RING_SIZE_DEFAULT	 	(4096)
+#define RING_SIZE_MIN	 		(PAGE_SIZE)
+/* Open addressing hash set of accepted NMEA addresses, keep it half empty */
+#define FILTER_HASH_BITS	 	(6)
+#define FILTER_SLOTS	 		(1 << FILTER_HASH_BITS)
+/*
+ * Files reading one tty at the same time, see gnssposget_reader_cursor().
+ * Closing a file doesn't free its slot, a further reader takes the least
+ * recently used one. The reader it belonged to skips to new data on its
+ * next read() and finds an overrun counted in read_lost.
+ */
+#define READERS_MAX	 		(8)
 #define MAGIC_NUMBER	 		(0x5101)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -25,34 +41,114 @@
 
 typedef unsigned char U8;
 
+/*
+ * NMEA sentence or UBX frame being assembled. It only takes ring space
+ * once it is complete and kept, dropped frames never push out records.
+ */
 struct nmea_container {
-    U8 nmea_text[NMEA_MAX_LENGTH];
 	bool valid_frame;
+	bool ubx;
     int index;
+    ktime_t stamp;
+    int filter_index;	/* Entry of filter_list that accepted the sentence */
+    u32 ubx_left;		/* UBX payload and checksum bytes still to come */
+    U8 buf[FRAME_MAX];
+};
+
+/* Satellite signal summary gathered from GSV sentences */
+struct gnssposget_gsv {
+	bool valid;
+	u8 sats_in_view;
+	u8 snr_count;
+	u8 snr_max;
+	u32 snr_sum;
+};
+
+/* Reader position inside the receive ring */
+struct gnssposget_cursor {
+	u32 pos;
+	u32 off;
+	u16 len;	/* Length and type of the record being handed out */
+	u16 type;
+	u32 fill;	/* Bytes still owed for a record lost half way through */
+	u32 lost;	/* Times records were overwritten before this reader got them */
+	u32 room;	/* Size of the caller's buffer when a read() last filled it, 0 if unknown */
+};
+
+/* A file reading the tty and where it is in the receive ring */
+struct gnssposget_reader {
+	struct file *file;
+	u64 gen;	/* f_version given to @file when it got this slot */
+	unsigned long last_used;	/* jiffies */
+	struct gnssposget_cursor cur;
 };
 
-struct nmea_cbuf {
-	U8 buf[NMEA_MAX_LENGTH];
-	int len;
-	bool partial_read;
+/**
+ * struct gnssposget_ring - receive ring shared with userspace
+ * @ref: held by the tty and by every ring file descriptor
+ * @hdr: start of the vmalloc_user() area, header page followed by @data
+ * @data: record area
+ * @size: size of @data, power of two
+ * @wait: ring file descriptor users waiting for @hdr->head to move
+ * @dead: line discipline was detached, @hdr->head won't move anymore
+ */
+struct gnssposget_ring {
+	struct kref				ref;
+	struct gnssposget_ring_hdr	*hdr;
+	U8						*data;
+	u32						size;
+	wait_queue_head_t		wait;
+	bool					dead;
 };
 
 /**
  * struct n_gnssposget - per device instance data structure
  * @magic: magic value for structure
- * @tbusy: reentrancy flag for tx wakeup code
- * @woke_up: tx wakeup needs to be run again as it was called while @tbusy
- * @tx_buf_list: list of pending transmit frame buffers
- * @rx_buf_list: list of received frame buffers
- * @tx_free_buf_list: list unused transmit frame buffers
- * @rx_free_buf_list: list unused received frame buffers
+ * @tty: tty we are attached to, its read_wait wakes read() and poll()
+ * @nmeatxt: frame currently being assembled, copied to @ring when it is kept
+ * @ring: receive ring owned by this tty
+ * @readers: read() and poll() users, each with its own position in @ring
+ * @reader_gen: last generation handed to a reader, see gnssposget_reader_cursor()
+ * @read_start: where new readers start, head of @ring when the mode last changed
+ * @read_lost: overruns of all readers, see struct gnssposget_cursor
+ * @read_backlog_max: most bytes a reader found queued for it
+ * @mode: GNSSPOSGET_MODE_*
+ * @gsv_pending: GSV summary collected since the last RMC
+ * @gsv_last: GSV summary reported with fix records
+ * @filter_list: accepted addresses as set by userspace
+ * @filter: hash set built from @filter_list, 0 marks an empty slot
+ * @filter_index: entry of @filter_list each @filter slot came from
+ * @stats: receive statistics, read_lost and ring_size are filled in on request
+ * @debugfs: statistics file under /sys/kernel/debug/gnssposget
+ * @ack: last UBX command written and how the receiver answered it
+ * @ack_wait: writer waiting for @ack to settle
+ * @write_lock: one UBX command in flight at a time
+ * @mutex_lock: serializes readers and protects @readers and @read_*, held across a multi-record read
+ * @lock: protects @nmeatxt, @mode, @gsv_*, @filter*, @stats, @ack, @flags and the producer side of @ring
+ * @flags: GNSSPOSGET_* state bits
  */
 struct n_gnssposget {
 	int						magic;
+	struct tty_struct		*tty;
 	struct nmea_container	*nmeatxt;
-	struct nmea_cbuf		nmea_temp;
+	struct gnssposget_ring	*ring;
+	struct gnssposget_reader	readers[READERS_MAX];
+	u64						reader_gen;
+	u32						read_start;
+	u32						read_lost;
+	u32						read_backlog_max;
+	u32						mode;
+	struct gnssposget_gsv	gsv_pending;
+	struct gnssposget_gsv	gsv_last;
+	struct gnssposget_filter	filter_list;
+	u32						filter[FILTER_SLOTS];
+	u8						filter_index[FILTER_SLOTS];
+	struct gnssposget_stats	stats;
+	struct dentry			*debugfs;
+	struct gnssposget_ack	ack;
+	wait_queue_head_t		ack_wait;
+	struct mutex			write_lock;
 	struct mutex			mutex_lock;
-	wait_queue_head_t 		read_queue;
 	spinlock_t 				lock;
 	unsigned long 			flags;
 };
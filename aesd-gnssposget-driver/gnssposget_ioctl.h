@@ -0,0 +1,199 @@
+/*
+ * gnssposget_ioctl.h
+ *
+ * Definitions shared between the n_gnssposget line discipline
+ * and userspace applications
+ */
+
+#ifndef GNSSPOSGET_IOCTL_H
+#define GNSSPOSGET_IOCTL_H
+
+#ifdef __KERNEL__
+#include <asm-generic/ioctl.h>
+#include <linux/types.h>
+#else
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#endif
+
+/*
+ * Receive ring shared with userspace.
+ *
+ * GNSSPOSGET_IOCGRINGFD returns a file descriptor that can be mapped
+ * read-only with mmap(). The mapping starts with struct gnssposget_ring_hdr,
+ * records follow at data_offset. head and tail are free running byte
+ * positions, a position is turned into an offset with (pos & (size - 1)).
+ *
+ * The kernel never waits for readers: when the ring is full the oldest
+ * records are overwritten and tail moves forward. A reader keeps its own
+ * position, reads records between it and head (after an acquire load of
+ * head) and checks that tail did not pass the record once it is done
+ * with it. If it did, the record was overwritten and the reader restarts
+ * from tail.
+ */
+struct gnssposget_ring_hdr
+{
+    __u32 head;         /* End of the last complete record */
+    __u32 tail;         /* Start of the oldest record still in the ring */
+    __u32 size;         /* Size of the record area, power of two */
+    __u32 data_offset;  /* Offset of the record area from the start of the mapping */
+};
+
+/* Record header. Records are GNSSPOSGET_REC_ALIGN aligned and never wrap */
+struct gnssposget_rec
+{
+    __u16 len;          /* Payload length */
+    __u16 type;         /* GNSSPOSGET_REC_* */
+    __u32 reserved;
+    __s64 stamp_ns;     /* ktime_get() (CLOCK_MONOTONIC) when the first byte arrived */
+};
+
+/* Padding up to the end of the record area, continue at offset 0 */
+#define GNSSPOSGET_REC_PAD          (0)
+/* NUL terminated NMEA sentence */
+#define GNSSPOSGET_REC_NMEA         (1)
+/* struct gnssposget_fix, GNSSPOSGET_MODE_FIX only */
+#define GNSSPOSGET_REC_FIX          (2)
+/* UBX frame from the sync characters through the checksum, GNSSPOSGET_MODE_TEXT_TS only */
+#define GNSSPOSGET_REC_UBX          (3)
+
+#define GNSSPOSGET_REC_ALIGN        (sizeof(struct gnssposget_rec))
+#define GNSSPOSGET_REC_SIZE(len)    ((sizeof(struct gnssposget_rec) + (len) + GNSSPOSGET_REC_ALIGN - 1) & \
+                                     ~(GNSSPOSGET_REC_ALIGN - 1))
+
+/*
+ * Fix record decoded in the kernel from RMC and the GSV sentences before it,
+ * or from a UBX NAV-PVT message. read() returns one of these per RMC or
+ * NAV-PVT in GNSSPOSGET_MODE_FIX.
+ */
+struct gnssposget_fix
+{
+    __s64 arrival_ns;   /* ktime_get() when '$' of the RMC sentence arrived */
+    __u32 utc_ms;       /* UTC time of day in milliseconds */
+    __u32 speed_mmps;   /* Speed over ground in millimetres per second */
+    __u32 date;         /* ddmmyy */
+    __u32 flags;        /* GNSSPOSGET_FIX_* */
+    __u8  status;       /* RMC status character, 'A' or 'D' when the fix is valid */
+    __u8  sats_in_view; /* Satellites in view, all talkers */
+    __u8  snr_max;      /* Best SNR in dBHz */
+    __u8  snr_mean;     /* Mean SNR in dBHz of satellites that report one */
+    __u8  snr_count;    /* Satellites that report an SNR */
+    __u8  fix_type;     /* NAV-PVT fixType, 0 for RMC */
+    __u8  sats_used;    /* NAV-PVT numSV, 0 for RMC */
+    __u8  reserved0;
+    __u32 speed_acc_mmps; /* NAV-PVT speed accuracy estimate in millimetres per second */
+    __u8  reserved[28];
+};
+
+#define GNSSPOSGET_FIX_TIME_VALID   (1U << 0)
+#define GNSSPOSGET_FIX_SPEED_VALID  (1U << 1)
+#define GNSSPOSGET_FIX_DATE_VALID   (1U << 2)
+#define GNSSPOSGET_FIX_VALID        (1U << 3)
+#define GNSSPOSGET_FIX_SATS_VALID   (1U << 4)
+#define GNSSPOSGET_FIX_SPEED_ACC_VALID (1U << 5)
+
+/*
+ * read() hands out whole records only. EOVERFLOW means the next one is
+ * bigger than the buffer, NMEA sentences take up to 128 bytes.
+ */
+/* read() returns NUL terminated sentences, default */
+#define GNSSPOSGET_MODE_TEXT        (0)
+/* read() returns struct gnssposget_fix records */
+#define GNSSPOSGET_MODE_FIX         (1)
+/* read() returns each sentence preceded by its struct gnssposget_rec */
+#define GNSSPOSGET_MODE_TEXT_TS     (2)
+
+/*
+ * Accepted NMEA addresses (talker ID + sentence type), e.g. "GPRMC".
+ * "--" as talker matches any talker: "--GSV" takes GPGSV, GLGSV, GAGSV...
+ * Sentences with other addresses are dropped as soon as their address
+ * is received. Default is GPTXT, GPRMC and GPGSV.
+ */
+#define GNSSPOSGET_ADDR_LEN         (5)
+#define GNSSPOSGET_FILTER_MAX       (32)
+/* Dropped addresses counted one by one, further ones only in the total */
+#define GNSSPOSGET_FILTERED_MAX     (16)
+
+struct gnssposget_filter
+{
+    __u32 count;
+    char  addr[GNSSPOSGET_FILTER_MAX][GNSSPOSGET_ADDR_LEN];
+};
+
+/*
+ * Receive statistics of a tty since the line discipline was attached.
+ * Also readable as text from /sys/kernel/debug/gnssposget/<tty name>.
+ */
+struct gnssposget_stats
+{
+    __u64 rx_bytes;         /* Bytes received from the tty driver */
+    __u32 accepted;         /* Complete sentences that passed the filter */
+    __u32 filtered;         /* Sentences dropped by the filter */
+    __u32 bad_checksum;     /* Sentences dropped for a wrong checksum, GNSSPOSGET_MODE_FIX only */
+    __u32 overlong;         /* Frames dropped for being longer than an NMEA sentence */
+    __u32 truncated;        /* Frames cut short by the next '$' */
+    __u32 ubx_accepted;     /* UBX frames with a good checksum */
+    __u32 ubx_bad_checksum; /* UBX frames dropped for a wrong checksum */
+    __u32 ubx_oversized;    /* UBX frames dropped for a payload we don't buffer */
+    __u32 tty_errors;       /* Frames dropped for containing bytes flagged by the tty driver */
+    __u32 breaks;           /* Flagged bytes by kind: TTY_BREAK */
+    __u32 framing;          /* TTY_FRAME */
+    __u32 parity;           /* TTY_PARITY */
+    __u32 overruns;         /* TTY_OVERRUN */
+    __u32 evicted;          /* Records overwritten by newer ones */
+    __u32 read_lost;        /* Times read() found its next record overwritten */
+    __u32 read_backlog_max; /* High-water mark of bytes queued ahead of read() */
+    __u32 ring_size;        /* Size of the record area */
+    __u32 accepted_by_addr[GNSSPOSGET_FILTER_MAX]; /* accepted per gnssposget_filter entry */
+    __u32 filtered_by_addr[GNSSPOSGET_FILTERED_MAX]; /* filtered per filtered_addr entry */
+    char  filtered_addr[GNSSPOSGET_FILTERED_MAX][GNSSPOSGET_ADDR_LEN]; /* In the order first dropped, "" unused */
+};
+
+/*
+ * UBX commands.
+ *
+ * write() on the tty takes one complete UBX frame per call. CFG class
+ * frames then wait up to the ack_timeout_ms module parameter for the
+ * receiver to answer: ACK-ACK returns the frame length, ACK-NAK fails
+ * with EREMOTEIO and silence with ETIMEDOUT. O_NONBLOCK writers return as
+ * soon as the frame is sent and follow the outcome with GNSSPOSGET_IOCGACK.
+ */
+#define GNSSPOSGET_ACK_NONE         (0) /* Command doesn't get acknowledged */
+#define GNSSPOSGET_ACK_PENDING      (1)
+#define GNSSPOSGET_ACK_ACK          (2)
+#define GNSSPOSGET_ACK_NAK          (3)
+#define GNSSPOSGET_ACK_TIMEOUT      (4)
+
+struct gnssposget_ack
+{
+    __u8  cls;          /* Class and ID of the last command written */
+    __u8  id;
+    __u8  status;       /* GNSSPOSGET_ACK_* */
+    __u8  reserved;
+};
+
+/* Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst */
+#define GNSSPOSGET_IOC_MAGIC        (0xB5)
+
+/* Called on the tty: returns a new file descriptor for the receive ring */
+#define GNSSPOSGET_IOCGRINGFD       _IO(GNSSPOSGET_IOC_MAGIC, 1)
+/* Called on the ring fd: sleeps until head differs from the given position */
+#define GNSSPOSGET_IOCWAIT          _IOW(GNSSPOSGET_IOC_MAGIC, 2, __u32)
+
+/* Called on the tty: select / query GNSSPOSGET_MODE_*. Switching drops unread records */
+#define GNSSPOSGET_IOCSMODE         _IOW(GNSSPOSGET_IOC_MAGIC, 3, __u32)
+#define GNSSPOSGET_IOCGMODE         _IOR(GNSSPOSGET_IOC_MAGIC, 4, __u32)
+
+/* Called on the tty: replace / query the accepted sentence set */
+#define GNSSPOSGET_IOCSFILTER       _IOW(GNSSPOSGET_IOC_MAGIC, 5, struct gnssposget_filter)
+#define GNSSPOSGET_IOCGFILTER       _IOR(GNSSPOSGET_IOC_MAGIC, 6, struct gnssposget_filter)
+
+/* Called on the tty: snapshot of struct gnssposget_stats */
+#define GNSSPOSGET_IOCGSTATS        _IOR(GNSSPOSGET_IOC_MAGIC, 7, struct gnssposget_stats)
+
+/* Called on the tty: outcome of the last UBX command */
+#define GNSSPOSGET_IOCGACK          _IOR(GNSSPOSGET_IOC_MAGIC, 8, struct gnssposget_ack)
+
+#define GNSSPOSGET_IOC_MAXNR        (8)
+
+#endif /* GNSSPOSGET_IOCTL_H */
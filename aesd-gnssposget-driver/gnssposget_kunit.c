@@ -0,0 +1,762 @@
+/*
+* @file gnssposget_kunit.c
+* @brief KUnit suites for the n_gnssposget line discipline
+*
+* Included by aesd-gnssposget-driver.c when built with make KUNIT=y,
+* so the suites reach its static functions. They run when the module
+* is loaded into a kernel with CONFIG_KUNIT and report in KTAP on the
+* kernel log. Every suite drives a fake tty that exists only here,
+* no serial port is needed.
+*
+*/
+
+#include <kunit/test.h>
+
+static unsigned int bench_epochs = 2000;
+module_param(bench_epochs, uint, S_IRUGO);
+MODULE_PARM_DESC(bench_epochs, "Receive benchmark: synthetic epochs pushed through the discipline");
+
+static unsigned int bench_chunk = 64;
+module_param(bench_chunk, uint, S_IRUGO);
+MODULE_PARM_DESC(bench_chunk, "Receive benchmark: bytes per receive_buf call, serial drivers hand over 1 to a few hundred");
+
+static unsigned int bench_rate = 0;
+module_param(bench_rate, uint, S_IRUGO);
+MODULE_PARM_DESC(bench_rate, "Rate benchmark: sentences per second to inject, 0 for as fast as possible");
+
+static unsigned int bench_sentences = 20000;
+module_param(bench_sentences, uint, S_IRUGO);
+MODULE_PARM_DESC(bench_sentences, "Rate benchmark: sentences to inject");
+
+/*----------------------------------------
+     Fake tty
+/*----------------------------------------*/
+#define GNSSPOSGET_TEST_BUF_SIZE    (4096)
+
+struct gnssposget_test {
+    struct tty_struct *tty;
+    struct file *file;
+    struct n_gnssposget *n_gnssposget;
+    U8 *buf;    /* read() buffer, GNSSPOSGET_TEST_BUF_SIZE bytes */
+};
+
+static int gnssposget_test_tty_write(struct tty_struct *tty, const unsigned char *buf, int count)
+{
+    return count;
+}
+
+static unsigned int gnssposget_test_tty_write_room(struct tty_struct *tty)
+{
+    return GNSSPOSGET_TEST_BUF_SIZE;
+}
+
+static const struct tty_operations gnssposget_test_tty_ops = {
+    .write      = gnssposget_test_tty_write,
+    .write_room = gnssposget_test_tty_write_room,
+};
+
+/* Attaches the discipline to a tty that only exists for the test */
+static int gnssposget_test_init(struct kunit *test)
+{
+    struct gnssposget_test *t;
+
+    t = kunit_kzalloc(test, sizeof(struct gnssposget_test), GFP_KERNEL);
+    if (!t)
+        return -ENOMEM;
+
+    t->tty = kunit_kzalloc(test, sizeof(struct tty_struct), GFP_KERNEL);
+    t->file = kunit_kzalloc(test, sizeof(struct file), GFP_KERNEL);
+    t->buf = kunit_kzalloc(test, GNSSPOSGET_TEST_BUF_SIZE, GFP_KERNEL);
+    if (!t->tty || !t->file || !t->buf)
+        return -ENOMEM;
+
+    t->tty->magic = TTY_MAGIC;
+    t->tty->ops = &gnssposget_test_tty_ops;
+    strscpy(t->tty->name, "gnssposget-kunit", sizeof(t->tty->name));
+    init_waitqueue_head(&t->tty->read_wait);
+    init_waitqueue_head(&t->tty->write_wait);
+    t->file->f_flags = O_RDWR | O_NONBLOCK;
+
+    if (n_gnssposget_ldisc.open(t->tty) != 0)
+        return -ENOMEM;
+
+    t->n_gnssposget = t->tty->disc_data;
+    test->priv = t;
+    return 0;
+}
+
+static void gnssposget_test_exit(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+
+    n_gnssposget_ldisc.close(t->tty);
+}
+
+/* Hands @count bytes to the discipline in receive_buf calls of @chunk bytes, 0 for one call */
+static void gnssposget_test_feed(struct gnssposget_test *t, const void *data, size_t count, size_t chunk)
+{
+    const U8 *cp = data;
+    size_t n;
+
+    while (count > 0) {
+        n = ((chunk != 0) && (chunk < count)) ? chunk : count;
+        n_gnssposget_ldisc.receive_buf(t->tty, cp, NULL, n);
+        cp += n;
+        count -= n;
+    }
+}
+
+/* read() of @nr bytes the way iterate_tty_read() in the tty core does it */
+static ssize_t gnssposget_test_read(struct gnssposget_test *t, size_t nr)
+{
+    U8 kernel_buf[GNSSPOSGET_READ_CHUNK];
+    unsigned long offset = 0;
+    void *cookie = NULL;
+    ssize_t ret;
+    size_t size;
+
+    do {
+        size = MIN(nr - offset, sizeof(kernel_buf));
+        ret = n_gnssposget_ldisc.read(t->tty, t->file, kernel_buf, size, &cookie, offset);
+        if (ret <= 0)
+            break;
+
+        memcpy(&t->buf[offset], kernel_buf, ret);
+        offset += ret;
+    } while (cookie);
+
+    return offset ? (ssize_t)offset : ret;
+}
+
+/* Sentences in what read() returned, each one ends with a NUL */
+static u32 gnssposget_test_count(const U8 *buf, size_t len)
+{
+    u32 count = 0;
+
+    while (len-- > 0)
+        count += (*buf++ == '\0');
+
+    return count;
+}
+
+/* Appends "*hh\r\n" to the sentence in @s, returns its full length */
+static int gnssposget_test_sentence(char *s, size_t size)
+{
+    int len = strlen(s);
+    U8 sum = 0;
+    int i;
+
+    for (i = 1; i < len; i++)
+        sum ^= (U8)s[i];
+
+    return len + scnprintf(&s[len], size - len, "*%02X\r\n", sum);
+}
+
+/* Sentence @body with "*hh\r\n" added in @s, and in @expected what read() returns for it */
+static int gnssposget_test_nmea(char *s, char *expected, size_t size, const char *body)
+{
+    int len;
+
+    strscpy(s, body, size);
+    len = gnssposget_test_sentence(s, size);
+    /* The line ends at '\r', the '\n' after it is skipped as noise */
+    strscpy(expected, s, len);
+    return len;
+}
+
+/* UBX frame of class @cls and @id around @payload, returns its length */
+static int gnssposget_test_ubx(U8 *frame, U8 cls, U8 id, const U8 *payload, u16 len)
+{
+    U8 ck_a = 0, ck_b = 0;
+    int i;
+
+    frame[0] = UBX_SYNC_1;
+    frame[1] = UBX_SYNC_2;
+    frame[2] = cls;
+    frame[3] = id;
+    frame[4] = len & 0xFF;
+    frame[5] = len >> 8;
+    memcpy(&frame[UBX_HDR_LEN], payload, len);
+    for (i = 2; i < (UBX_HDR_LEN + len); i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    frame[UBX_HDR_LEN + len] = ck_a;
+    frame[UBX_HDR_LEN + len + 1] = ck_b;
+
+    return UBX_HDR_LEN + len + UBX_CK_LEN;
+}
+
+/* Reads all that is queued and checks it is exactly the @count sentences in @expected */
+static void gnssposget_test_expect(struct kunit *test, const char * const *expected, int count)
+{
+    struct gnssposget_test *t = test->priv;
+    const char *s;
+    ssize_t ret;
+    int i = 0;
+
+    while ((ret = gnssposget_test_read(t, GNSSPOSGET_TEST_BUF_SIZE)) > 0) {
+        /* Whole sentences only */
+        KUNIT_ASSERT_EQ(test, t->buf[ret - 1], (U8)'\0');
+        for (s = (const char *)t->buf; s < (const char *)&t->buf[ret]; s += strlen(s) + 1) {
+            if (i < count)
+                KUNIT_EXPECT_STREQ(test, s, expected[i]);
+            i++;
+        }
+    }
+
+    KUNIT_EXPECT_EQ(test, ret, (ssize_t)-EAGAIN);
+    KUNIT_EXPECT_EQ(test, i, count);
+}
+
+/*----------------------------------------
+     Receive path
+/*----------------------------------------*/
+/* A sentence cut at every possible place, and one byte per call */
+static void gnssposget_test_split(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+    char s[NMEA_MAX_LENGTH], expected[NMEA_MAX_LENGTH];
+    const char *e = expected;
+    int len, cut;
+
+    len = gnssposget_test_nmea(s, expected, sizeof(s),
+                               "$GPRMC,142502.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A");
+    for (cut = 1; cut < len; cut++) {
+        gnssposget_test_feed(t, s, cut, 0);
+        gnssposget_test_feed(t, &s[cut], len - cut, 0);
+        gnssposget_test_expect(test, &e, 1);
+    }
+
+    gnssposget_test_feed(t, s, len, 1);
+    gnssposget_test_expect(test, &e, 1);
+
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted, (u32)len);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.truncated, 0U);
+}
+
+/* Lines longer than NMEA_MAX_LENGTH - 1 are dropped, whatever the chunks */
+static void gnssposget_test_overlong(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+    char body[NMEA_MAX_LENGTH + 64];
+    char s[sizeof(body) + 8], expected[sizeof(body) + 8];
+    char fits[NMEA_MAX_LENGTH], next[NMEA_MAX_LENGTH];
+    const char *e[2] = { fits, next };
+    int len, chunk;
+
+    /* "*hh\r" and the NUL leave 123 characters for the body */
+    memset(body, 'x', sizeof(body));
+    memcpy(body, "$GPTXT,", 7);
+    body[NMEA_MAX_LENGTH - 5] = '\0';
+    len = gnssposget_test_nmea(s, fits, sizeof(s), body);
+    gnssposget_test_feed(t, s, len, 0);
+    gnssposget_test_expect(test, e, 1);
+    KUNIT_EXPECT_EQ(test, strlen(fits), (size_t)(NMEA_MAX_LENGTH - 1));
+
+    for (chunk = 0; chunk <= 16; chunk += 16) {
+        body[NMEA_MAX_LENGTH - 5] = 'x';
+        body[NMEA_MAX_LENGTH - 4] = '\0';
+        len = gnssposget_test_nmea(s, expected, sizeof(s), body);
+        gnssposget_test_feed(t, s, len, chunk);
+
+        body[sizeof(body) - 1] = '\0';
+        len = gnssposget_test_nmea(s, expected, sizeof(s), body);
+        gnssposget_test_feed(t, s, len, chunk);
+
+        len = gnssposget_test_nmea(s, next, sizeof(s), "$GPTXT,01,01,02,after the long ones");
+        gnssposget_test_feed(t, s, len, chunk);
+        gnssposget_test_expect(test, &e[1], 1);
+    }
+
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.overlong, 4U);
+}
+
+/* Lines ending in a bare '\r' or a bare '\n' */
+static void gnssposget_test_line_end(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+    char s[3][NMEA_MAX_LENGTH], expected[3][NMEA_MAX_LENGTH];
+    const char *e[3] = { expected[0], expected[1], expected[2] };
+    int len[3];
+
+    len[0] = gnssposget_test_nmea(s[0], expected[0], NMEA_MAX_LENGTH, "$GPTXT,01,01,02,one");
+    len[1] = gnssposget_test_nmea(s[1], expected[1], NMEA_MAX_LENGTH, "$GPTXT,01,01,02,two");
+    len[2] = gnssposget_test_nmea(s[2], expected[2], NMEA_MAX_LENGTH, "$GPTXT,01,01,02,three");
+
+    /* one\r two\r three\n */
+    gnssposget_test_feed(t, s[0], len[0] - 1, 0);
+    gnssposget_test_feed(t, s[1], len[1] - 1, 0);
+    s[2][len[2] - 2] = '\n';
+    expected[2][len[2] - 2] = '\n';
+    gnssposget_test_feed(t, s[2], len[2] - 1, 0);
+    gnssposget_test_expect(test, e, 3);
+
+    /* Line ends between sentences are noise */
+    gnssposget_test_feed(t, "\r\r\n\n\r", 5, 0);
+    gnssposget_test_expect(test, e, 0);
+
+    /* '$' before the line end starts over */
+    gnssposget_test_feed(t, "$GPTXT,01,01,02,cut", 19, 0);
+    gnssposget_test_feed(t, s[0], len[0], 0);
+    gnssposget_test_expect(test, e, 1);
+
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted, 4U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.truncated, 1U);
+}
+
+/* A reader that falls behind loses the oldest sentences, never parts of one */
+static void gnssposget_test_overflow(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+    char s[NMEA_MAX_LENGTH], expected[NMEA_MAX_LENGTH], body[NMEA_MAX_LENGTH];
+    int i, count = 0, first = -1, seq;
+    const char *p;
+    ssize_t ret;
+
+    /* Nothing queued yet, this sets up the reader */
+    KUNIT_EXPECT_EQ(test, gnssposget_test_read(t, GNSSPOSGET_TEST_BUF_SIZE), (ssize_t)-EAGAIN);
+
+    for (i = 0; i < 400; i++) {
+        scnprintf(body, sizeof(body), "$GPTXT,01,01,02,overflow %03d", i);
+        gnssposget_test_feed(t, s, gnssposget_test_nmea(s, expected, sizeof(s), body), 0);
+    }
+
+    while ((ret = gnssposget_test_read(t, GNSSPOSGET_TEST_BUF_SIZE)) > 0) {
+        KUNIT_ASSERT_EQ(test, t->buf[ret - 1], (U8)'\0');
+        for (p = (const char *)t->buf; p < (const char *)&t->buf[ret]; p += strlen(p) + 1) {
+            KUNIT_ASSERT_EQ(test, sscanf(p, "$GPTXT,01,01,02,overflow %d", &seq), 1);
+            if (first < 0)
+                first = seq;
+            KUNIT_EXPECT_EQ(test, seq, first + count);
+            count++;
+        }
+    }
+
+    /* The ring kept the newest ones */
+    KUNIT_EXPECT_GT(test, first, 0);
+    KUNIT_EXPECT_EQ(test, first + count, 400);
+    KUNIT_EXPECT_GT(test, t->n_gnssposget->stats.evicted, 0U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->read_lost, 1U);
+}
+
+static const char * const gnssposget_test_talkers[] = {
+    "$GPRMC,142502.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A",
+    "$GNRMC,142502.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A",
+    "$GLGSV,1,1,02,65,33,093,31,72,16,045,27",
+    "$GPGSV,1,1,02,03,33,093,31,04,16,045,27",
+    "$BDGSV,1,1,01,201,61,120,42",
+    "$GPTXT,01,01,02,ANTSTATUS=OK",
+    "$GAGSV,1,1,01,11,12,273,23",
+    "$GNGGA,142502.00,5109.12345,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,",
+};
+
+/* Feeds all of gnssposget_test_talkers, @expected gets what read() should return for those in @keep */
+static int gnssposget_test_feed_talkers(struct gnssposget_test *t, const int *keep, int count,
+                                        char expected[][NMEA_MAX_LENGTH])
+{
+    char s[NMEA_MAX_LENGTH], e[NMEA_MAX_LENGTH];
+    int i, k = 0;
+
+    for (i = 0; i < ARRAY_SIZE(gnssposget_test_talkers); i++) {
+        gnssposget_test_feed(t, s, gnssposget_test_nmea(s, e, sizeof(s), gnssposget_test_talkers[i]), 7);
+        if ((k < count) && (keep[k] == i))
+            strscpy(expected[k++], e, NMEA_MAX_LENGTH);
+    }
+
+    return k;
+}
+
+/* The default filter takes GPS talker RMC, GSV and TXT only */
+static void gnssposget_test_talkers_default(struct kunit *test)
+{
+    static const int keep[] = { 0, 3, 5 };
+    struct gnssposget_test *t = test->priv;
+    char expected[ARRAY_SIZE(keep)][NMEA_MAX_LENGTH];
+    const char *e[ARRAY_SIZE(keep)];
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(keep); i++)
+        e[i] = expected[i];
+
+    gnssposget_test_feed_talkers(t, keep, ARRAY_SIZE(keep), expected);
+    gnssposget_test_expect(test, e, ARRAY_SIZE(keep));
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.filtered, 5U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted_by_addr[0], 1U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted_by_addr[1], 1U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted_by_addr[2], 1U);
+    KUNIT_EXPECT_EQ(test, memcmp(t->n_gnssposget->stats.filtered_addr[0], "GNRMC", GNSSPOSGET_ADDR_LEN), 0);
+    KUNIT_EXPECT_EQ(test, memcmp(t->n_gnssposget->stats.filtered_addr[4], "GNGGA", GNSSPOSGET_ADDR_LEN), 0);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.filtered_by_addr[4], 1U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.filtered_addr[5][0], (char)'\0');
+}
+
+/* Any talker with "--", exact addresses, and lists that are refused */
+static void gnssposget_test_filter(struct kunit *test)
+{
+    static const int keep[] = { 1, 2, 3, 4, 6 };
+    struct gnssposget_test *t = test->priv;
+    struct gnssposget_filter *list;
+    char expected[ARRAY_SIZE(keep)][NMEA_MAX_LENGTH];
+    const char *e[ARRAY_SIZE(keep)];
+    int i;
+
+    list = kunit_kzalloc(test, sizeof(struct gnssposget_filter), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, list);
+    for (i = 0; i < ARRAY_SIZE(keep); i++)
+        e[i] = expected[i];
+
+    list->count = 2;
+    memcpy(list->addr[0], "--GSV", GNSSPOSGET_ADDR_LEN);
+    memcpy(list->addr[1], "GNRMC", GNSSPOSGET_ADDR_LEN);
+    KUNIT_ASSERT_EQ(test, gnssposget_filter_set(t->n_gnssposget, list), 0);
+
+    gnssposget_test_feed_talkers(t, keep, ARRAY_SIZE(keep), expected);
+    gnssposget_test_expect(test, e, ARRAY_SIZE(keep));
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted_by_addr[0], 4U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.accepted_by_addr[1], 1U);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.filtered, 3U);
+    /* Dropped addresses of the default filter were forgotten with it */
+    KUNIT_EXPECT_EQ(test, memcmp(t->n_gnssposget->stats.filtered_addr[0], "GPRMC", GNSSPOSGET_ADDR_LEN), 0);
+    KUNIT_EXPECT_EQ(test, memcmp(t->n_gnssposget->stats.filtered_addr[1], "GPTXT", GNSSPOSGET_ADDR_LEN), 0);
+    KUNIT_EXPECT_EQ(test, memcmp(t->n_gnssposget->stats.filtered_addr[2], "GNGGA", GNSSPOSGET_ADDR_LEN), 0);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.filtered_by_addr[2], 1U);
+
+    /* Refused lists leave the one in use alone */
+    memcpy(list->addr[1], "GN\001MC", GNSSPOSGET_ADDR_LEN);
+    KUNIT_EXPECT_EQ(test, gnssposget_filter_set(t->n_gnssposget, list), -EINVAL);
+    list->count = GNSSPOSGET_FILTER_MAX + 1;
+    KUNIT_EXPECT_EQ(test, gnssposget_filter_set(t->n_gnssposget, list), -EINVAL);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->filter_list.count, 2U);
+
+    gnssposget_test_feed_talkers(t, keep, ARRAY_SIZE(keep), expected);
+    gnssposget_test_expect(test, e, ARRAY_SIZE(keep));
+}
+
+/*
+ * A CFG command written, then its ACK-ACK arriving in pieces between
+ * NMEA sentences. Answers to other commands and broken frames don't
+ * settle it, and no UBX bytes show up in the text stream.
+ */
+static void gnssposget_test_ubx_ack(struct kunit *test)
+{
+    static const U8 cfg_msg[] = { 0xF0, 0x02, 0x00 };   /* GSA off */
+    static const U8 ack_other[] = { UBX_CLASS_CFG, 0x08 };
+    static const U8 ack_msg[] = { UBX_CLASS_CFG, 0x01 };
+    struct gnssposget_test *t = test->priv;
+    struct gnssposget_ack *ack = &t->n_gnssposget->ack;
+    char s[2][NMEA_MAX_LENGTH], expected[2][NMEA_MAX_LENGTH];
+    const char *e[2] = { expected[0], expected[1] };
+    U8 frame[32], reply[16];
+    struct gnssposget_rec *rec;
+    int len[2], cmd, n;
+    ssize_t ret;
+
+    len[0] = gnssposget_test_nmea(s[0], expected[0], NMEA_MAX_LENGTH, "$GPTXT,01,01,02,before");
+    len[1] = gnssposget_test_nmea(s[1], expected[1], NMEA_MAX_LENGTH, "$GPTXT,01,01,02,after");
+
+    /* Only whole UBX frames may be written */
+    KUNIT_EXPECT_EQ(test, n_gnssposget_ldisc.write(t->tty, t->file, (const U8 *)s[0], len[0]),
+                    (ssize_t)-EINVAL);
+
+    /* O_NONBLOCK writers don't wait for the answer */
+    cmd = gnssposget_test_ubx(frame, UBX_CLASS_CFG, 0x01, cfg_msg, sizeof(cfg_msg));
+    KUNIT_ASSERT_EQ(test, n_gnssposget_ldisc.write(t->tty, t->file, frame, cmd), (ssize_t)cmd);
+    KUNIT_EXPECT_EQ(test, ack->status, (u8)GNSSPOSGET_ACK_PENDING);
+
+    n = gnssposget_test_ubx(reply, UBX_CLASS_ACK, UBX_ACK_ACK, ack_other, sizeof(ack_other));
+    gnssposget_test_feed(t, reply, n, 0);
+    KUNIT_EXPECT_EQ(test, ack->status, (u8)GNSSPOSGET_ACK_PENDING);
+
+    n = gnssposget_test_ubx(reply, UBX_CLASS_ACK, UBX_ACK_ACK, ack_msg, sizeof(ack_msg));
+    reply[n - 1] ^= 0xFF;
+    gnssposget_test_feed(t, reply, n, 0);
+    KUNIT_EXPECT_EQ(test, ack->status, (u8)GNSSPOSGET_ACK_PENDING);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.ubx_bad_checksum, 1U);
+
+    reply[n - 1] ^= 0xFF;
+    gnssposget_test_feed(t, s[0], len[0], 0);
+    gnssposget_test_feed(t, reply, 3, 0);
+    gnssposget_test_feed(t, &reply[3], 4, 0);
+    KUNIT_EXPECT_EQ(test, ack->status, (u8)GNSSPOSGET_ACK_PENDING);
+    gnssposget_test_feed(t, &reply[7], n - 7, 0);
+    gnssposget_test_feed(t, s[1], len[1], 0);
+    KUNIT_EXPECT_EQ(test, ack->status, (u8)GNSSPOSGET_ACK_ACK);
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->stats.ubx_accepted, 2U);
+    gnssposget_test_expect(test, e, 2);
+
+    /* Timestamped readers get the frame as it came */
+    KUNIT_ASSERT_EQ(test, gnssposget_mode_set(t->n_gnssposget, GNSSPOSGET_MODE_TEXT_TS), 0);
+    gnssposget_test_feed(t, reply, n, 5);
+    ret = gnssposget_test_read(t, GNSSPOSGET_TEST_BUF_SIZE);
+    KUNIT_ASSERT_EQ(test, ret, (ssize_t)(REC_HDR_LEN + n));
+    rec = (struct gnssposget_rec *)t->buf;
+    KUNIT_EXPECT_EQ(test, rec->type, (u16)GNSSPOSGET_REC_UBX);
+    KUNIT_EXPECT_EQ(test, rec->len, (u16)n);
+    KUNIT_EXPECT_EQ(test, memcmp(&t->buf[REC_HDR_LEN], reply, n), 0);
+}
+
+static struct kunit_case gnssposget_receive_cases[] = {
+    KUNIT_CASE(gnssposget_test_split),
+    KUNIT_CASE(gnssposget_test_overlong),
+    KUNIT_CASE(gnssposget_test_line_end),
+    KUNIT_CASE(gnssposget_test_overflow),
+    KUNIT_CASE(gnssposget_test_talkers_default),
+    KUNIT_CASE(gnssposget_test_filter),
+    KUNIT_CASE(gnssposget_test_ubx_ack),
+    {}
+};
+
+static struct kunit_suite gnssposget_receive_suite = {
+    .name = "gnssposget_receive",
+    .init = gnssposget_test_init,
+    .exit = gnssposget_test_exit,
+    .test_cases = gnssposget_receive_cases,
+};
+
+/*----------------------------------------
+     Receive benchmark
+/*----------------------------------------*/
+/* Ten epochs of a NEO-6M with its factory message set, from power up to moving */
+static const char * const gnssposget_bench_corpus[] = {
+        "$GPTXT,01,01,02,u-blox ag - www.u-blox.com*50\r\n",
+        "$GPTXT,01,01,02,HW  UBX-G60xx  00040007 FF7FFFFFp*53\r\n",
+        "$GPTXT,01,01,02,ROM CORE 7.03 (45969) Mar 17 2011 16:18:34*59\r\n",
+        "$GPTXT,01,01,02,ANTSTATUS=OK*3B\r\n",
+        "$GPRMC,142500.00,V,,,,,,,170926,,,N*74\r\n",
+        "$GPVTG,,,,,,,,,N*30\r\n",
+        "$GPGGA,142500.00,,,,,0,04,99.99,,,,,,*60\r\n",
+        "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30\r\n",
+        "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,,,,,142500.00,V,N*48\r\n",
+        "$GPRMC,142501.00,V,,,,,,,170926,,,N*75\r\n",
+        "$GPVTG,,,,,,,,,N*30\r\n",
+        "$GPGGA,142501.00,,,,,0,04,99.99,,,,,,*61\r\n",
+        "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30\r\n",
+        "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23*7E\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35*73\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,,,,,142501.00,V,N*49\r\n",
+        "$GPRMC,142502.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A*65\r\n",
+        "$GPVTG,,T,,M,0.000,N,0.000,K,A*23\r\n",
+        "$GPGGA,142502.00,5109.12345,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7E\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,32,04,16,045,28,06,61,120,43,09,12,273,24*74\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,39,19,68,233,45,28,22,169,36*70\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12345,N,00012.34567,W,142502.00,A,A*77\r\n",
+        "$GPRMC,142503.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A*64\r\n",
+        "$GPVTG,,T,,M,0.000,N,0.000,K,A*23\r\n",
+        "$GPGGA,142503.00,5109.12345,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7F\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12345,N,00012.34567,W,142503.00,A,A*76\r\n",
+        "$GPRMC,142504.00,A,5109.12346,N,00012.34567,W,0.800,,170926,,,A*68\r\n",
+        "$GPVTG,,T,,M,0.800,N,1.482,K,A*24\r\n",
+        "$GPGGA,142504.00,5109.12346,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7B\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23*7E\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35*73\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12346,N,00012.34567,W,142504.00,A,A*72\r\n",
+        "$GPRMC,142505.00,A,5109.12347,N,00012.34567,W,1.600,,170926,,,A*67\r\n",
+        "$GPVTG,,T,,M,1.600,N,2.963,K,A*2A\r\n",
+        "$GPGGA,142505.00,5109.12347,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7B\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,32,04,16,045,28,06,61,120,43,09,12,273,24*74\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,39,19,68,233,45,28,22,169,36*70\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12347,N,00012.34567,W,142505.00,A,A*72\r\n",
+        "$GPRMC,142506.00,A,5109.12349,N,00012.34567,W,2.400,,170926,,,A*6B\r\n",
+        "$GPVTG,,T,,M,2.400,N,4.445,K,A*24\r\n",
+        "$GPGGA,142506.00,5109.12349,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*76\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12349,N,00012.34567,W,142506.00,A,A*7F\r\n",
+        "$GPRMC,142507.00,A,5109.12352,N,00012.34567,W,3.200,,170926,,,A*67\r\n",
+        "$GPVTG,,T,,M,3.200,N,5.926,K,A*2A\r\n",
+        "$GPGGA,142507.00,5109.12352,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7D\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23*7E\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35*73\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12352,N,00012.34567,W,142507.00,A,A*74\r\n",
+        "$GPRMC,142508.00,A,5109.12356,N,00012.34567,W,4.000,,170926,,,A*69\r\n",
+        "$GPVTG,,T,,M,4.000,N,7.408,K,A*2C\r\n",
+        "$GPGGA,142508.00,5109.12356,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*76\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,32,04,16,045,28,06,61,120,43,09,12,273,24*74\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,39,19,68,233,45,28,22,169,36*70\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12356,N,00012.34567,W,142508.00,A,A*7F\r\n",
+        "$GPRMC,142509.00,A,5109.12360,N,00012.34567,W,4.800,,170926,,,A*65\r\n",
+        "$GPVTG,,T,,M,4.800,N,8.890,K,A*26\r\n",
+        "$GPGGA,142509.00,5109.12360,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*72\r\n",
+        "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03\r\n",
+        "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C\r\n",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A\r\n",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40\r\n",
+        "$GPGLL,5109.12360,N,00012.34567,W,142509.00,A,A*7B\r\n",
+};
+
+/* One 1 Hz epoch of a NEO-6M with its factory message set, second @sec of the day */
+static size_t gnssposget_bench_epoch(char *burst, size_t size, unsigned int sec)
+{
+    static const char * const templates[] = {
+        "$GPRMC,%02u%02u%02u.00,A,5109.12345,N,00012.34567,W,0.012,,170926,,,A",
+        "$GPVTG,,T,,M,0.012,N,0.022,K,A",
+        "$GPGGA,%02u%02u%02u.00,5109.12345,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,",
+        "$GPGSA,A,3,03,04,06,09,12,17,19,28,,,,,1.95,1.01,1.67",
+        "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23",
+        "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35",
+        "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,",
+        "$GPGLL,5109.12345,N,00012.34567,W,%02u%02u%02u.00,A,A",
+        "$GPTXT,01,01,02,ANTSTATUS=OK",
+    };
+    char s[NMEA_MAX_LENGTH];
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(templates); i++) {
+        scnprintf(s, sizeof(s), templates[i], (sec / 3600) % 24, (sec / 60) % 60, sec % 60);
+        gnssposget_test_sentence(s, sizeof(s));
+        len += scnprintf(&burst[len], size - len, "%s", s);
+    }
+
+    return len;
+}
+
+/*
+ * Pushes bench_epochs synthetic epochs through receive_buf in
+ * bench_chunk byte calls and drains them with read() after every
+ * epoch, like a reader keeping up with the receiver. Time spent in
+ * each side is reported separately.
+ */
+static void gnssposget_bench_bursts(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+    u64 rx_ns = 0, read_ns = 0, rx_bytes = 0;
+    u32 sentences = 0;
+    char *burst;
+    size_t len;
+    ssize_t ret;
+    ktime_t start;
+    unsigned int i;
+
+    burst = kunit_kzalloc(test, GNSSPOSGET_TEST_BUF_SIZE, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, burst);
+
+    for (i = 0; i < bench_epochs; i++) {
+        len = gnssposget_bench_epoch(burst, GNSSPOSGET_TEST_BUF_SIZE, i);
+
+        start = ktime_get();
+        gnssposget_test_feed(t, burst, len, bench_chunk);
+        rx_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+        rx_bytes += len;
+
+        start = ktime_get();
+        while ((ret = gnssposget_test_read(t, GNSSPOSGET_TEST_BUF_SIZE)) > 0)
+            sentences += gnssposget_test_count(t->buf, ret);
+        read_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+        KUNIT_ASSERT_EQ(test, ret, (ssize_t)-EAGAIN);
+    }
+
+    /* RMC, three GSV and TXT pass the default filter */
+    KUNIT_EXPECT_EQ(test, sentences, bench_epochs * 5);
+
+    kunit_info(test, "%u epochs, %llu bytes in %u byte calls, %u sentences kept\n",
+               bench_epochs, rx_bytes, bench_chunk, sentences);
+    kunit_info(test, "receive: %llu ns/epoch, %llu MB/s\n", div_u64(rx_ns, bench_epochs),
+               div64_u64(rx_bytes * 1000, rx_ns ? rx_ns : 1));
+    kunit_info(test, "read: %llu ns/sentence\n", div_u64(read_ns, sentences ? sentences : 1));
+}
+
+/*
+ * Replays gnssposget_bench_corpus, bench_sentences sentences at
+ * bench_rate per second, each one in bench_chunk byte calls. A reader
+ * collects them every few sentences. Reports the rate reached and the
+ * CPU time per sentence spent receiving and reading it, sleeps between
+ * sentences left out.
+ */
+static void gnssposget_bench_rate(struct kunit *test)
+{
+    struct gnssposget_test *t = test->priv;
+    u64 rx_ns = 0, read_ns = 0, wall_ns;
+    u32 kept = 0;
+    const char *s;
+    s64 ahead;
+    u64 begin, start;
+    ssize_t ret;
+    unsigned int i;
+
+    begin = ktime_get_ns();
+    for (i = 0; i < bench_sentences; i++) {
+        if (bench_rate != 0) {
+            ahead = begin + div_u64((u64)i * NSEC_PER_SEC, bench_rate) - ktime_get_ns();
+            if (ahead > (100 * NSEC_PER_USEC))
+                usleep_range(div_u64(ahead, NSEC_PER_USEC), div_u64(ahead, NSEC_PER_USEC) + 100);
+        }
+
+        s = gnssposget_bench_corpus[i % ARRAY_SIZE(gnssposget_bench_corpus)];
+        start = ktime_get_ns();
+        gnssposget_test_feed(t, s, strlen(s), bench_chunk);
+        rx_ns += ktime_get_ns() - start;
+
+        if (((i % 8) == 7) || (i == (bench_sentences - 1))) {
+            start = ktime_get_ns();
+            while ((ret = gnssposget_test_read(t, GNSSPOSGET_TEST_BUF_SIZE)) > 0)
+                kept += gnssposget_test_count(t->buf, ret);
+            read_ns += ktime_get_ns() - start;
+        }
+    }
+    wall_ns = ktime_get_ns() - begin;
+
+    KUNIT_EXPECT_EQ(test, t->n_gnssposget->read_lost, 0U);
+    KUNIT_EXPECT_EQ(test, kept, t->n_gnssposget->stats.accepted);
+
+    kunit_info(test, "%u sentences, %u kept, asked for %u/s, reached %llu/s\n",
+               bench_sentences, kept, bench_rate,
+               div64_u64((u64)bench_sentences * NSEC_PER_SEC, wall_ns ? wall_ns : 1));
+    kunit_info(test, "CPU per sentence: receive %llu ns, read %llu ns per kept one\n",
+               div_u64(rx_ns, bench_sentences ? bench_sentences : 1),
+               div_u64(read_ns, kept ? kept : 1));
+}
+
+static struct kunit_case gnssposget_bench_cases[] = {
+    KUNIT_CASE(gnssposget_bench_bursts),
+    KUNIT_CASE(gnssposget_bench_rate),
+    {}
+};
+
+static struct kunit_suite gnssposget_bench_suite = {
+    .name = "gnssposget_bench",
+    .init = gnssposget_test_init,
+    .exit = gnssposget_test_exit,
+    .test_cases = gnssposget_bench_cases,
+};
+
+/*
+ * kunit_test_suites() would bring its own module_init, the driver
+ * already has one. Its init and exit run the suites instead.
+ */
+static struct kunit_suite *gnssposget_kunit_suites[] = {
+    &gnssposget_receive_suite,
+    &gnssposget_bench_suite,
+    NULL
+};
+
+static void gnssposget_kunit_init(void)
+{
+    __kunit_test_suites_init(gnssposget_kunit_suites);
+}
+
+static void gnssposget_kunit_exit(void)
+{
+    __kunit_test_suites_exit(gnssposget_kunit_suites);
+}
@@ -0,0 +1,237 @@
+/*
+ * gnssposget_ptytest.c
+ *
+ * Regression test for per-tty instances of the n_gnssposget line
+ * discipline. Attaches it to two pseudo terminal pairs, feeds both at
+ * full rate from their own thread and checks that every sentence read
+ * from one tty was written to that same tty, intact and in order.
+ *
+ * Needs the module loaded: sudo ./gnssposget_ptytest [seconds]
+ * Exits 0 when no sentence crossed over or arrived corrupted.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "gnssposget_ioctl.h"
+
+#define N_GNSSPOSGET            (20)
+#define PAIRS                   (2)
+#define DURATION_S_DEFAULT      (5)
+/* Reader gives up once the writer is done and nothing came for this long */
+#define DRAIN_TIMEOUT_MS        (500)
+#define READ_BUF_SIZE           (4096)
+#define SENTENCE_MAX            (128)
+
+struct pty_pair {
+    int id;
+    int master;
+    int slave;
+    volatile int writing;
+    unsigned long written;
+    unsigned long received;
+    unsigned long lost;     /* Sequence gaps, the ring overwrote them */
+    unsigned long crossed;  /* Sentences written to the other pair */
+    unsigned long corrupt;
+};
+
+static int duration_s = DURATION_S_DEFAULT;
+
+/* "$GPTXT,01,01,02,P<id> <seq>*hh\r\n", a sentence the default filter takes */
+static int make_sentence(char *buf, size_t size, int id, unsigned long seq)
+{
+    unsigned char sum = 0;
+    int len, i;
+
+    len = snprintf(buf, size, "$GPTXT,01,01,02,P%d %lu", id, seq);
+    for (i = 1; i < len; i++)
+        sum ^= (unsigned char)buf[i];
+
+    return len + snprintf(&buf[len], size - len, "*%02X\r\n", sum);
+}
+
+static int checksum_ok(const char *s)
+{
+    unsigned char sum = 0;
+    unsigned int expected;
+    const char *p;
+
+    for (p = &s[1]; (*p != '*') && (*p != '\0'); p++)
+        sum ^= (unsigned char)*p;
+
+    return (*p == '*') && (sscanf(p + 1, "%2X", &expected) == 1) && (sum == expected);
+}
+
+static void *writer_task(void *arg)
+{
+    struct pty_pair *pair = arg;
+    char sentence[SENTENCE_MAX];
+    struct timespec now, end;
+    int len;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += duration_s;
+    do {
+        len = make_sentence(sentence, sizeof(sentence), pair->id, pair->written);
+        if (write(pair->master, sentence, len) != len) {
+            perror("write");
+            break;
+        }
+
+        pair->written++;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec < end.tv_sec) || ((now.tv_sec == end.tv_sec) && (now.tv_nsec < end.tv_nsec)));
+
+    pair->writing = 0;
+    return NULL;
+}
+
+static void check_sentence(struct pty_pair *pair, const char *s, long *next_seq)
+{
+    int id;
+    unsigned long seq;
+
+    if (!checksum_ok(s) || (sscanf(s, "$GPTXT,01,01,02,P%d %lu*", &id, &seq) != 2)) {
+        pair->corrupt++;
+        return;
+    }
+
+    if (id != pair->id) {
+        pair->crossed++;
+        return;
+    }
+
+    if ((long)seq < *next_seq) {
+        /* Seen before or out of order */
+        pair->corrupt++;
+        return;
+    }
+
+    pair->lost += seq - *next_seq;
+    *next_seq = seq + 1;
+    pair->received++;
+}
+
+static void *reader_task(void *arg)
+{
+    struct pty_pair *pair = arg;
+    struct pollfd pfd = { .fd = pair->slave, .events = POLLIN };
+    char buf[READ_BUF_SIZE];
+    long next_seq = 0;
+    ssize_t ret;
+    char *s;
+
+    while (1) {
+        ret = poll(&pfd, 1, DRAIN_TIMEOUT_MS);
+        if (ret == 0) {
+            if (!pair->writing)
+                break;
+            continue;
+        }
+
+        ret = read(pair->slave, buf, sizeof(buf));
+        if (ret < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR))
+                continue;
+            perror("read");
+            break;
+        }
+
+        /* read() returns whole NUL terminated sentences */
+        for (s = buf; s < &buf[ret]; s += strlen(s) + 1) {
+            if (memchr(s, '\0', &buf[ret] - s) == NULL) {
+                pair->corrupt++;
+                break;
+            }
+            check_sentence(pair, s, &next_seq);
+        }
+    }
+
+    return NULL;
+}
+
+static int pair_open(struct pty_pair *pair, int id)
+{
+    int ldisc = N_GNSSPOSGET;
+    struct termios tio;
+    char *name;
+
+    pair->id = id;
+    pair->writing = 1;
+    pair->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((pair->master < 0) || (grantpt(pair->master) < 0) || (unlockpt(pair->master) < 0) ||
+        ((name = ptsname(pair->master)) == NULL)) {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    pair->slave = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (pair->slave < 0) {
+        perror(name);
+        return -1;
+    }
+
+    /* Bytes go through untouched on the way to the line discipline */
+    tcgetattr(pair->slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pair->slave, TCSANOW, &tio);
+    tcgetattr(pair->master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pair->master, TCSANOW, &tio);
+
+    if (ioctl(pair->slave, TIOCSETD, &ldisc) < 0) {
+        perror("ioctl(TIOCSETD), is the module loaded");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct pty_pair pairs[PAIRS];
+    pthread_t writers[PAIRS], readers[PAIRS];
+    int i, failed = 0;
+
+    if (argc > 1)
+        duration_s = atoi(argv[1]);
+
+    memset(pairs, 0, sizeof(pairs));
+    for (i = 0; i < PAIRS; i++) {
+        if (pair_open(&pairs[i], i) < 0)
+            return 2;
+    }
+
+    for (i = 0; i < PAIRS; i++) {
+        pthread_create(&readers[i], NULL, reader_task, &pairs[i]);
+        pthread_create(&writers[i], NULL, writer_task, &pairs[i]);
+    }
+
+    for (i = 0; i < PAIRS; i++) {
+        pthread_join(writers[i], NULL);
+        pthread_join(readers[i], NULL);
+    }
+
+    for (i = 0; i < PAIRS; i++) {
+        printf("pty %d: written %lu received %lu lost %lu crossed %lu corrupt %lu\n",
+               i, pairs[i].written, pairs[i].received, pairs[i].lost,
+               pairs[i].crossed, pairs[i].corrupt);
+        if ((pairs[i].received == 0) || (pairs[i].crossed != 0) || (pairs[i].corrupt != 0))
+            failed = 1;
+        close(pairs[i].slave);
+        close(pairs[i].master);
+    }
+
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}
@@ -0,0 +1,170 @@
+/*
+ * gnssposget_trace.h
+ *
+ * Tracepoints on the n_gnssposget hot path. Ring positions are the free
+ * running byte positions of struct gnssposget_ring_hdr, times are
+ * ktime_get() nanoseconds so they compare with the record stamps.
+ *
+ * echo 1 > /sys/kernel/tracing/events/gnssposget/enable
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gnssposget
+
+#if !defined(GNSSPOSGET_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define GNSSPOSGET_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+/* Chunk handed over by the tty driver, ring use before it is processed */
+TRACE_EVENT(gnssposget_receive,
+    TP_PROTO(const char *tty, int count, u32 head, u32 tail),
+    TP_ARGS(tty, count, head, tail),
+
+    TP_STRUCT__entry(
+        __string(tty, tty)
+        __field(int, count)
+        __field(u32, head)
+        __field(u32, used)
+    ),
+
+    TP_fast_assign(
+        __assign_str(tty, tty);
+        __entry->count = count;
+        __entry->head = head;
+        __entry->used = head - tail;
+    ),
+
+    TP_printk("%s count=%d head=%u used=%u",
+              __get_str(tty), __entry->count, __entry->head, __entry->used)
+);
+
+/* Complete sentence that passed the filter, latency is since its '$' arrived */
+TRACE_EVENT(gnssposget_nmea,
+    TP_PROTO(const char *tty, const unsigned char *text, int len, s64 arrival_ns, u32 used),
+    TP_ARGS(tty, text, len, arrival_ns, used),
+
+    TP_STRUCT__entry(
+        __string(tty, tty)
+        __array(char, addr, 6)
+        __field(int, len)
+        __field(s64, arrival_ns)
+        __field(s64, latency_ns)
+        __field(u32, used)
+    ),
+
+    TP_fast_assign(
+        __assign_str(tty, tty);
+        memcpy(__entry->addr, &text[1], 5);
+        __entry->addr[5] = '\0';
+        __entry->len = len;
+        __entry->arrival_ns = arrival_ns;
+        __entry->latency_ns = ktime_get_ns() - arrival_ns;
+        __entry->used = used;
+    ),
+
+    TP_printk("%s %s len=%d arrival=%lld latency=%lldns used=%u",
+              __get_str(tty), __entry->addr, __entry->len,
+              __entry->arrival_ns, __entry->latency_ns, __entry->used)
+);
+
+/* One read() step, pos is where the reader stopped */
+TRACE_EVENT(gnssposget_read,
+    TP_PROTO(const char *tty, u32 pos, size_t nr, size_t copied),
+    TP_ARGS(tty, pos, nr, copied),
+
+    TP_STRUCT__entry(
+        __string(tty, tty)
+        __field(u32, pos)
+        __field(size_t, nr)
+        __field(size_t, copied)
+    ),
+
+    TP_fast_assign(
+        __assign_str(tty, tty);
+        __entry->pos = pos;
+        __entry->nr = nr;
+        __entry->copied = copied;
+    ),
+
+    TP_printk("%s pos=%u nr=%zu copied=%zu",
+              __get_str(tty), __entry->pos, __entry->nr, __entry->copied)
+);
+
+/* Record fully handed out to a reader, wait is how long it was in the kernel */
+TRACE_EVENT(gnssposget_read_record,
+    TP_PROTO(u32 pos, u16 type, u16 len, s64 stamp_ns),
+    TP_ARGS(pos, type, len, stamp_ns),
+
+    TP_STRUCT__entry(
+        __field(u32, pos)
+        __field(u16, type)
+        __field(u16, len)
+        __field(s64, stamp_ns)
+        __field(s64, wait_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->pos = pos;
+        __entry->type = type;
+        __entry->len = len;
+        __entry->stamp_ns = stamp_ns;
+        __entry->wait_ns = ktime_get_ns() - stamp_ns;
+    ),
+
+    TP_printk("pos=%u type=%u len=%u stamp=%lld wait=%lldns",
+              __entry->pos, __entry->type, __entry->len,
+              __entry->stamp_ns, __entry->wait_ns)
+);
+
+/* Producer overwrote the oldest records to make room */
+TRACE_EVENT(gnssposget_overflow,
+    TP_PROTO(u32 dropped, u32 tail, u32 head, u32 size),
+    TP_ARGS(dropped, tail, head, size),
+
+    TP_STRUCT__entry(
+        __field(u32, dropped)
+        __field(u32, tail)
+        __field(u32, head)
+        __field(u32, size)
+    ),
+
+    TP_fast_assign(
+        __entry->dropped = dropped;
+        __entry->tail = tail;
+        __entry->head = head;
+        __entry->size = size;
+    ),
+
+    TP_printk("dropped=%u tail=%u head=%u size=%u",
+              __entry->dropped, __entry->tail, __entry->head, __entry->size)
+);
+
+/* A reader's next record was overwritten, it continues from tail */
+TRACE_EVENT(gnssposget_reader_overrun,
+    TP_PROTO(u32 pos, u32 tail),
+    TP_ARGS(pos, tail),
+
+    TP_STRUCT__entry(
+        __field(u32, pos)
+        __field(u32, tail)
+    ),
+
+    TP_fast_assign(
+        __entry->pos = pos;
+        __entry->tail = tail;
+    ),
+
+    TP_printk("pos=%u tail=%u lost=%u", __entry->pos, __entry->tail,
+              __entry->tail - __entry->pos)
+);
+
+#endif /* GNSSPOSGET_TRACE_H */
+
+/* Outside the include guard, define_trace.h includes us again */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gnssposget_trace
+#include <trace/define_trace.h>
@@ -15,9 +15,11 @@
 
 
 #define SPEED_DATA_CHUNK        (256U)
-#define CHECKPOINT_1            (30.0)
-#define CHECKPOINT_2            (60.0)
-#define CHECKPOINT_3            (100.0)
+/* km/h */
+#define CHECKPOINT_1            (30)
+#define CHECKPOINT_2            (60)
+#define CHECKPOINT_3            (100)
+#define MS_PER_DAY              (86400000L)
 
 /* Consecutive instances of speed to detect starting point */
 #define JITTER_SMOOTH_COUNT     (5U)
@@ -30,8 +32,8 @@
 
 typedef struct
 {
-    double timestamp;
-    double speed;
+    S32 utc_ms;         /* Milliseconds since midnight UTC */
+    S32 speed_mmps;     /* Millimetres per second */
 } speed_data_chunk;
 
 typedef struct
@@ -62,7 +64,8 @@ static Boolean is_running;
 static void speed_data_add(acceleration_data *data, speed_data_chunk speed);
 static void speed_data_init(acceleration_data *dataArray, size_t capacity);
 static void speed_data_free(acceleration_data *dataArray);
-static int get_starting_point(double threshold, int jitter_count);
+static int get_starting_point(int threshold, int jitter_count);
+static S32 utc_ms_elapsed(S32 from_ms, S32 to_ms);
 
 /* ---------------------------------------------  */
 /* Public functions */
@@ -90,13 +93,13 @@ void accelmeter_app_stop(void)
     }
 }
 
-Boolean accelmeter_app_add_data(double timestamp, double speed)
+Boolean accelmeter_app_add_data(S32 utc_ms, S32 speed_mmps)
 {
     Boolean result = FALSE;
     if (is_running == TRUE)
     {
-        speed_data_chunk chunk = {timestamp, speed};
-        if ((accel.size > 0) && (timestamp == accel.data[accel.size - 1].timestamp))
+        speed_data_chunk chunk = {utc_ms, speed_mmps};
+        if ((accel.size > 0) && (utc_ms == accel.data[accel.size - 1].utc_ms))
         {
             /* Not adding data with the same timestamp as previous element */
             result = FALSE;
@@ -126,53 +129,54 @@ int accelmeter_app_get_incorrect_data_count(void)
     return accel.incorrect_data_count;
 }
 
-double accelmeter_app_get_current_checkpoint(void)
+int accelmeter_app_get_current_checkpoint(void)
 {
-    double current_checkpoint;
+    int current_checkpoint;
     if (accel.checkpoint1 == FALSE)
     {
-        current_checkpoint = (double)CHECKPOINT_1;
+        current_checkpoint = CHECKPOINT_1;
     }
     else if (accel.checkpoint2 == FALSE)
     {
-        current_checkpoint = (double)CHECKPOINT_2;
+        current_checkpoint = CHECKPOINT_2;
     }
     else if (accel.checkpoint3 == FALSE)
     {
-        current_checkpoint = (double)CHECKPOINT_3;
+        current_checkpoint = CHECKPOINT_3;
     }
     else
     {
         /* No checkpoints left */
-        current_checkpoint = 0.0;
+        current_checkpoint = 0;
     }
 
     return current_checkpoint;
 }
 
-void accelmeter_app_set_checkpoint(double checkpoint)
+void accelmeter_app_set_checkpoint(int checkpoint)
 {
-    if (checkpoint == (double)CHECKPOINT_1)
+    if (checkpoint == CHECKPOINT_1)
     {
         accel.checkpoint1 = TRUE;
     }
-    else if (checkpoint == (double)CHECKPOINT_2)
+    else if (checkpoint == CHECKPOINT_2)
     {
         accel.checkpoint2 = TRUE;
     }
-    else if (checkpoint == (double)CHECKPOINT_3)
+    else if (checkpoint == CHECKPOINT_3)
     {
         accel.checkpoint3 = TRUE;
     }
 }
 
-void accelmeter_app_analyze_data(double *time1, double *time2, double *time3)
+void accelmeter_app_analyze_data(S32 *time1_ms, S32 *time2_ms, S32 *time3_ms)
 {
     int start_index = 0;
-    double start_timestamp = 0.0, cur_checkpoint = 0.0;
+    S32 start_ms = 0;
+    int cur_checkpoint = 0;
     int idx = 0;
 
-    *time1 = *time2 = *time3 = -1;
+    *time1_ms = *time2_ms = *time3_ms = -1;
     if (is_running == TRUE)
     {
         if (accel.checkpoint1 == TRUE)
@@ -182,28 +186,28 @@ void accelmeter_app_analyze_data(double *time1, double *time2, double *time3)
             if (start_index >= 0)
             {
                 /* Perform analysis on the data starting from start_index */
-                start_timestamp = accel.data[start_index].timestamp;
-                cur_checkpoint = (double)CHECKPOINT_1;
+                start_ms = accel.data[start_index].utc_ms;
+                cur_checkpoint = CHECKPOINT_1;
                 for (idx = start_index; idx < accel.size; idx++)
                 {
-                    if (accel.data[idx].speed > cur_checkpoint)
+                    if (ACCELMETER_APP_SPEED_ABOVE(accel.data[idx].speed_mmps, cur_checkpoint))
                     {
-                       if (cur_checkpoint == (double)CHECKPOINT_1)
+                       if (cur_checkpoint == CHECKPOINT_1)
                        {
-                           *time1 = accel.data[idx].timestamp - start_timestamp;
-                            aesdlog_dbg_info("accelmeter_app_analyze_data: checkpoint 1 time=%.3lf", *time1);
-                           cur_checkpoint = (double)CHECKPOINT_2;
+                           *time1_ms = utc_ms_elapsed(start_ms, accel.data[idx].utc_ms);
+                            aesdlog_dbg_info("accelmeter_app_analyze_data: checkpoint 1 time=%ld ms", (long)*time1_ms);
+                           cur_checkpoint = CHECKPOINT_2;
                        }
-                       else if (cur_checkpoint == (double)CHECKPOINT_2)
+                       else if (cur_checkpoint == CHECKPOINT_2)
                        {
-                            *time2 = accel.data[idx].timestamp - start_timestamp;
-                            aesdlog_dbg_info("accelmeter_app_analyze_data: checkpoint 2 time=%.3lf", *time2);
-                            cur_checkpoint = (double)CHECKPOINT_3;
+                            *time2_ms = utc_ms_elapsed(start_ms, accel.data[idx].utc_ms);
+                            aesdlog_dbg_info("accelmeter_app_analyze_data: checkpoint 2 time=%ld ms", (long)*time2_ms);
+                            cur_checkpoint = CHECKPOINT_3;
                        }
-                       else if (cur_checkpoint == (double)CHECKPOINT_3)
+                       else if (cur_checkpoint == CHECKPOINT_3)
                        {
-                            *time3 = accel.data[idx].timestamp - start_timestamp;
-                            aesdlog_dbg_info("accelmeter_app_analyze_data: checkpoint 3 time=%.3lf", *time3);
+                            *time3_ms = utc_ms_elapsed(start_ms, accel.data[idx].utc_ms);
+                            aesdlog_dbg_info("accelmeter_app_analyze_data: checkpoint 3 time=%ld ms", (long)*time3_ms);
                             break;
                        }
                     }
@@ -237,8 +241,8 @@ void accelmeter_app_accel_to_file(void)
     fprintf(file, "------------------------------------------------\n");
     fprintf(file, "Acceleration Data:\n");
     for (int i = 0; i < accel.size; i++) {
-        fprintf(file, "Timestamp: %.3lf, Speed: %.3lf\n",
-                accel.data[i].timestamp, accel.data[i].speed);
+        fprintf(file, "UTC: %ld ms, Speed: %ld mm/s\n",
+                (long)accel.data[i].utc_ms, (long)accel.data[i].speed_mmps);
     }
 
     fclose(file);
@@ -254,18 +258,18 @@ void accelmeter_app_accel_to_file(void)
 
 /* Calculates acceleration starting point
 *
-*  @param threshold The speed threshold to consider
+*  @param threshold The speed threshold to consider (km/h)
 *  @param jitter_count The number of consecutive samples above the threshold
 *
 *  @return The index of the starting point or -1 if not found
 */
-static int get_starting_point(double threshold, int jitter_count)
+static int get_starting_point(int threshold, int jitter_count)
 {
     aesdlog_dbg_info("accelmeter_app_get_starting_point: Started searching for starting point");
     int idx, start_index = -1, temp_index, hits = 0;
     for (idx = 0; idx < accel.size; idx++)
     {
-        if (accel.data[idx].speed > threshold) 
+        if (ACCELMETER_APP_SPEED_ABOVE(accel.data[idx].speed_mmps, threshold))
         {
             hits++;
             if (hits >= jitter_count)
@@ -290,7 +294,7 @@ static int get_starting_point(double threshold, int jitter_count)
         jitter_count = 2;
         for(idx = (temp_index - 1); idx >= 0; idx--)
         {
-            if (accel.data[idx].speed > accel.data[idx + 1].speed)
+            if (accel.data[idx].speed_mmps > accel.data[idx + 1].speed_mmps)
             {
                 hits++;
                 if (hits >= jitter_count)
@@ -310,6 +314,12 @@ static int get_starting_point(double threshold, int jitter_count)
     return start_index;
 }
 
+/* Time from from_ms to to_ms, both UTC time of day, across midnight too */
+static S32 utc_ms_elapsed(S32 from_ms, S32 to_ms)
+{
+    return (to_ms >= from_ms) ? (to_ms - from_ms) : (to_ms + MS_PER_DAY - from_ms);
+}
+
 static void speed_data_init(acceleration_data *dataArray, size_t capacity)
 {
     dataArray->data = malloc(capacity * sizeof(speed_data_chunk));
@@ -4,22 +4,26 @@
 #include "typedefs.h"
 
 
-/* Consider that acceleration started from this speed */
-#define ACCELMETER_APP_START_SPEED_THRESHOLD    (3.0)
+/* Consider that acceleration started from this speed (km/h) */
+#define ACCELMETER_APP_START_SPEED_THRESHOLD    (3)
 /* Initial capacity for speed data storage */
 #define ACCELMETER_APP_INITIAL_CAPACITY        (10U)
 /* Number of allowed instances of incorrect data */
 #define ACCELMETER_APP_MAX_INCORRECT_DATA_INSTANCES (5U)
 
+/* Exact speed comparisons: 1 km/h = 10000 / 36 mm/s */
+#define ACCELMETER_APP_SPEED_REACHED(mmps, kmh)  (((S64)(mmps) * 36) >= ((S64)(kmh) * 10000))
+#define ACCELMETER_APP_SPEED_ABOVE(mmps, kmh)    (((S64)(mmps) * 36) > ((S64)(kmh) * 10000))
+
 extern void accelmeter_app_stop(void);
 extern void accelmeter_app_start(void);
-extern Boolean accelmeter_app_add_data(double timestamp, double speed);
+extern Boolean accelmeter_app_add_data(S32 utc_ms, S32 speed_mmps);
 extern int  accelmeter_app_get_data_size(void);
 extern void accelmeter_app_handle_incorrect_data(void);
 extern int  accelmeter_app_get_incorrect_data_count(void);
-extern double accelmeter_app_get_current_checkpoint(void);
-extern void accelmeter_app_set_checkpoint(double checkpoint);
-extern void accelmeter_app_analyze_data(double *time1, double *time2, double *time3);
+extern int  accelmeter_app_get_current_checkpoint(void);
+extern void accelmeter_app_set_checkpoint(int checkpoint);
+extern void accelmeter_app_analyze_data(S32 *time1_ms, S32 *time2_ms, S32 *time3_ms);
 
 /* debug */
 extern void accelmeter_app_accel_to_file(void);
@@ -8,7 +8,6 @@ case "$1" in
         ;;
     stop)
         echo "Stopping aesd-gnssposget-server"
-        killall gnss_module_start.sh
         start-stop-daemon -K -x /usr/bin/aesd-gnssposget-server
         ;;
     *)
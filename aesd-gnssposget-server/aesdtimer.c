@@ -48,6 +48,20 @@ Boolean timer_is_elapsed(int timeout)
     return result;
 }
 
+/* Milliseconds until timer_is_elapsed(timeout) turns TRUE, -1 while the timer is stopped */
+int timer_remaining_ms(int timeout)
+{
+    double remaining;
+
+    if (timer.is_running == FALSE)
+    {
+        return -1;
+    }
+
+    remaining = timeout - timer_poll();
+    return (remaining > 0.0) ? ((int)(remaining * 1000.0) + 1) : 0;
+}
+
 static double timer_poll(void)
 {
     double elapsed = 0;
@@ -6,5 +6,6 @@
 extern void timer_start(void);
 extern void timer_stop(void);
 extern Boolean timer_is_elapsed(int timeout);
+extern int timer_remaining_ms(int timeout);
 
 #endif /* AESTIMER_H */
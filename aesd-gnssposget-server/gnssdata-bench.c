@@ -0,0 +1,360 @@
+/*
+ * gnssdata-bench.c
+ *
+ * Microbenchmark of the NMEA parser in gnssdata.c. Feeds a recorded
+ * NEO-6M stream to extract_nmea() the way read_data_task() does and
+ * reports sentences per second and heap allocations per sentence.
+ * Then times the fixed point time and speed decoders against the
+ * sscanf()/atof() ones they replaced, on the RMC fields of the stream.
+ * Built with make bench, gnssdata.c is included so its static parser
+ * is reachable. Logging is counted instead of going to syslog.
+ *
+ * Usage: ./gnssdata-bench [passes] [file with one sentence per line]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "gnssdata.c"
+
+#define BENCH_PASSES_DEFAULT        (20000)
+#define BENCH_SENTENCES_MAX         (4096U)
+#define BENCH_LINE_LEN              (128U)
+#define BENCH_FIELD_LEN             (16U)
+
+/* Ten epochs of a NEO-6M with its factory message set, from power up to moving */
+static const char *const bench_corpus[] =
+{
+    "$GPTXT,01,01,02,u-blox ag - www.u-blox.com*50",
+    "$GPTXT,01,01,02,HW  UBX-G60xx  00040007 FF7FFFFFp*53",
+    "$GPTXT,01,01,02,ROM CORE 7.03 (45969) Mar 17 2011 16:18:34*59",
+    "$GPTXT,01,01,02,ANTSTATUS=OK*3B",
+    "$GPRMC,142500.00,V,,,,,,,170926,,,N*74",
+    "$GPVTG,,,,,,,,,N*30",
+    "$GPGGA,142500.00,,,,,0,04,99.99,,,,,,*60",
+    "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30",
+    "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,,,,,142500.00,V,N*48",
+    "$GPRMC,142501.00,V,,,,,,,170926,,,N*75",
+    "$GPVTG,,,,,,,,,N*30",
+    "$GPGGA,142501.00,,,,,0,04,99.99,,,,,,*61",
+    "$GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99*30",
+    "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23*7E",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35*73",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,,,,,142501.00,V,N*49",
+    "$GPRMC,142502.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A*65",
+    "$GPVTG,,T,,M,0.000,N,0.000,K,A*23",
+    "$GPGGA,142502.00,5109.12345,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7E",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,32,04,16,045,28,06,61,120,43,09,12,273,24*74",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,39,19,68,233,45,28,22,169,36*70",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12345,N,00012.34567,W,142502.00,A,A*77",
+    "$GPRMC,142503.00,A,5109.12345,N,00012.34567,W,0.000,,170926,,,A*64",
+    "$GPVTG,,T,,M,0.000,N,0.000,K,A*23",
+    "$GPGGA,142503.00,5109.12345,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7F",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12345,N,00012.34567,W,142503.00,A,A*76",
+    "$GPRMC,142504.00,A,5109.12346,N,00012.34567,W,0.800,,170926,,,A*68",
+    "$GPVTG,,T,,M,0.800,N,1.482,K,A*24",
+    "$GPGGA,142504.00,5109.12346,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7B",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23*7E",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35*73",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12346,N,00012.34567,W,142504.00,A,A*72",
+    "$GPRMC,142505.00,A,5109.12347,N,00012.34567,W,1.600,,170926,,,A*67",
+    "$GPVTG,,T,,M,1.600,N,2.963,K,A*2A",
+    "$GPGGA,142505.00,5109.12347,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7B",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,32,04,16,045,28,06,61,120,43,09,12,273,24*74",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,39,19,68,233,45,28,22,169,36*70",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12347,N,00012.34567,W,142505.00,A,A*72",
+    "$GPRMC,142506.00,A,5109.12349,N,00012.34567,W,2.400,,170926,,,A*6B",
+    "$GPVTG,,T,,M,2.400,N,4.445,K,A*24",
+    "$GPGGA,142506.00,5109.12349,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*76",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12349,N,00012.34567,W,142506.00,A,A*7F",
+    "$GPRMC,142507.00,A,5109.12352,N,00012.34567,W,3.200,,170926,,,A*67",
+    "$GPVTG,,T,,M,3.200,N,5.926,K,A*2A",
+    "$GPGGA,142507.00,5109.12352,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*7D",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,31,04,16,045,27,06,61,120,42,09,12,273,23*7E",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,38,19,68,233,44,28,22,169,35*73",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12352,N,00012.34567,W,142507.00,A,A*74",
+    "$GPRMC,142508.00,A,5109.12356,N,00012.34567,W,4.000,,170926,,,A*69",
+    "$GPVTG,,T,,M,4.000,N,7.408,K,A*2C",
+    "$GPGGA,142508.00,5109.12356,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*76",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,32,04,16,045,28,06,61,120,43,09,12,273,24*74",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,39,19,68,233,45,28,22,169,36*70",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12356,N,00012.34567,W,142508.00,A,A*7F",
+    "$GPRMC,142509.00,A,5109.12360,N,00012.34567,W,4.800,,170926,,,A*65",
+    "$GPVTG,,T,,M,4.800,N,8.890,K,A*26",
+    "$GPGGA,142509.00,5109.12360,N,00012.34567,W,1,08,1.01,45.6,M,47.0,M,,*72",
+    "$GPGSA,A,3,03,04,06,09,17,19,28,,,,,,1.95,1.01,1.67*03",
+    "$GPGSV,3,1,11,03,33,093,30,04,16,045,26,06,61,120,41,09,12,273,22*7C",
+    "$GPGSV,3,2,11,12,07,330,,17,43,298,37,19,68,233,43,28,22,169,34*7A",
+    "$GPGSV,3,3,11,30,02,040,,46,29,150,,48,32,194,*40",
+    "$GPGLL,5109.12360,N,00012.34567,W,142509.00,A,A*7B",
+};
+
+static char bench_lines[BENCH_SENTENCES_MAX][BENCH_LINE_LEN];
+static unsigned int bench_count;
+
+static unsigned long allocations;
+static unsigned long log_calls;
+
+/* Time and speed fields of the RMC sentences, NUL terminated like strsep() left them */
+static char bench_utc[BENCH_SENTENCES_MAX][BENCH_FIELD_LEN];
+static char bench_speed[BENCH_SENTENCES_MAX][BENCH_FIELD_LEN];
+static unsigned int bench_rmc_count;
+
+/* Keeps the compiler from dropping decoded values nobody looks at */
+static volatile double sink_double;
+static volatile S32 sink_s32;
+
+/* Linked with --wrap, every heap allocation of the process passes here */
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+/* Stand-ins for aesdlog.c, the parser is measured without syslog */
+void aesdlog_init(void)
+{
+}
+
+void aesdlog_info(const char *message, ...)
+{
+    (void)message;
+    log_calls++;
+}
+
+void aesdlog_dbg_info(const char *message, ...)
+{
+    (void)message;
+}
+
+void aesdlog_err(const char *message, ...)
+{
+    (void)message;
+    log_calls++;
+}
+
+static S64 bench_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((S64)now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+/* UTC decoder of gnssdata.c before fixed point, seconds since midnight */
+static double bench_parse_utc_to_seconds(const char *utc_str)
+{
+    int hh = 0, mm = 0;
+    double ss = 0.0;
+
+    if (sscanf(utc_str, "%2d%2d%lf", &hh, &mm, &ss) != 3)
+    {
+        return -1.0;
+    }
+
+    return hh * 3600.0 + mm * 60.0 + ss;
+}
+
+/* Copies out the time and speed fields of every RMC in the stream */
+static void bench_collect_rmc(void)
+{
+    struct nmea_fields fields;
+    unsigned int i;
+
+    for (i = 0U; i < bench_count; i++)
+    {
+        if ((nmea_tokenize(bench_lines[i], &fields) == FALSE) || (fields.len[0] != NMEA_ADDR_LEN) ||
+            (memcmp(&fields.start[0][NMEA_TALKER_LEN], "RMC", NMEA_TYPE_LEN) != 0) ||
+            (fields.count <= RMC_INDEX_SPEED_K))
+        {
+            continue;
+        }
+
+        (void)snprintf(bench_utc[bench_rmc_count], BENCH_FIELD_LEN, "%.*s",
+                       (int)fields.len[RMC_INDEX_TIME], fields.start[RMC_INDEX_TIME]);
+        (void)snprintf(bench_speed[bench_rmc_count], BENCH_FIELD_LEN, "%.*s",
+                       (int)fields.len[RMC_INDEX_SPEED_K], fields.start[RMC_INDEX_SPEED_K]);
+        bench_rmc_count++;
+    }
+}
+
+/* Time and speed of each RMC, with the old double decoders and with the fixed point ones */
+static void bench_decoders(unsigned long passes)
+{
+    unsigned long pass;
+    unsigned int i;
+    U32 utc_ms, speed_mknots;
+    S64 start, old_ns, new_ns;
+
+    bench_collect_rmc();
+    if (bench_rmc_count == 0U)
+    {
+        printf("decoders: no RMC sentences to decode\n");
+        return;
+    }
+
+    start = bench_now_ns();
+    for (pass = 0U; pass < passes; pass++)
+    {
+        for (i = 0U; i < bench_rmc_count; i++)
+        {
+            sink_double = bench_parse_utc_to_seconds(bench_utc[i]);
+            sink_double = atof(bench_speed[i]);
+        }
+    }
+    old_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (pass = 0U; pass < passes; pass++)
+    {
+        for (i = 0U; i < bench_rmc_count; i++)
+        {
+            if (nmea_parse_utc(bench_utc[i], strlen(bench_utc[i]), &utc_ms) == TRUE)
+            {
+                sink_s32 = (S32)utc_ms;
+            }
+
+            if (nmea_parse_fixed(bench_speed[i], strlen(bench_speed[i]), KNOT_FRACTION_DIGITS, &speed_mknots) == TRUE)
+            {
+                sink_s32 = knots_to_mmps(speed_mknots);
+            }
+        }
+    }
+    new_ns = bench_now_ns() - start;
+
+    printf("decoders: %lu RMC time and speed pairs\n", passes * bench_rmc_count);
+    printf("decoders: sscanf()/atof() %.1f ns/pair, fixed point %.1f ns/pair\n",
+           (double)old_ns / (double)(passes * bench_rmc_count),
+           (double)new_ns / (double)(passes * bench_rmc_count));
+}
+
+/* One sentence per line, line ends and empty lines are dropped */
+static Boolean bench_load(const char *path)
+{
+    FILE *file;
+    size_t len;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return FALSE;
+    }
+
+    while ((bench_count < BENCH_SENTENCES_MAX) &&
+           (fgets(bench_lines[bench_count], BENCH_LINE_LEN, file) != NULL))
+    {
+        len = strcspn(bench_lines[bench_count], "\r\n");
+        bench_lines[bench_count][len] = '\0';
+        if (len > 0U)
+        {
+            bench_count++;
+        }
+    }
+
+    fclose(file);
+    return (bench_count > 0U) ? TRUE : FALSE;
+}
+
+int main(int argc, char **argv)
+{
+    static char sentence[BENCH_LINE_LEN];
+    unsigned long passes = BENCH_PASSES_DEFAULT;
+    unsigned long pass, sentences, allocs;
+    unsigned int i;
+    S64 start, elapsed;
+
+    if (argc > 1)
+    {
+        passes = strtoul(argv[1], NULL, 10);
+    }
+
+    if (argc > 2)
+    {
+        if (bench_load(argv[2]) == FALSE)
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        for (i = 0U; i < (sizeof(bench_corpus) / sizeof(bench_corpus[0])); i++)
+        {
+            (void)snprintf(bench_lines[i], BENCH_LINE_LEN, "%s", bench_corpus[i]);
+        }
+        bench_count = i;
+    }
+
+    /* Warm up, and nothing counted comes from setting up */
+    for (i = 0U; i < bench_count; i++)
+    {
+        (void)memcpy(sentence, bench_lines[i], BENCH_LINE_LEN);
+        extract_nmea(sentence, bench_now_ns());
+    }
+
+    allocs = allocations;
+    log_calls = 0U;
+    start = bench_now_ns();
+    for (pass = 0U; pass < passes; pass++)
+    {
+        for (i = 0U; i < bench_count; i++)
+        {
+            /* read_data_task() hands over its read buffer, the parser may write to it */
+            (void)memcpy(sentence, bench_lines[i], BENCH_LINE_LEN);
+            extract_nmea(sentence, start);
+        }
+    }
+    elapsed = bench_now_ns() - start;
+    allocs = allocations - allocs;
+    sentences = passes * bench_count;
+
+    printf("parser: %lu sentences in %.3f s\n", sentences, (double)elapsed / 1e9);
+    printf("parser: %.0f sentences/s, %.1f ns/sentence\n",
+           (double)sentences * 1e9 / (double)elapsed, (double)elapsed / (double)sentences);
+    printf("parser: %.3f allocations/sentence, %.3f log calls/sentence\n",
+           (double)allocs / (double)sentences, (double)log_calls / (double)sentences);
+
+    bench_decoders(passes);
+    return 0;
+}
@@ -3,40 +3,69 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h> /* memory allocate */
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <linux/tty.h>   // for TIOCSETD
 #include <errno.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sched.h>
 
+#include "../aesd-gnssposget-driver/gnssposget_ioctl.h"
 #include "accelmeter-app.h"
 #include "typedefs.h"
 #include "aesdlog.h"
 #include "gnssdata.h"
+#include "gnssinput.h"
 
-/* Length of NMEA address ($GPXXX) */
-#define NMEA_ADDR_LEN               (6U)
-/* Index inside GSV NMEA of: number of satellites in view */
-#define GSV_INDEX_SAT_COUNT         (3U)
-/* Index inside GSV NMEA of: signal strength */
-#define GSV_INDEX_ANT_STR           (7U)
+/* Length of NMEA address (GPXXX): talker ID, then sentence type */
+#define NMEA_ADDR_LEN               (5U)
+#define NMEA_TALKER_LEN             (2U)
+#define NMEA_TYPE_LEN               (3U)
+/* Most fields of the sentences we decode, GSV with four satellites has 20 */
+#define NMEA_MAX_FIELDS             (24U)
+/* Index inside GSV NMEA of: number of sentences in the set */
+#define GSV_INDEX_MSG_TOTAL         (1U)
+/* Index inside GSV NMEA of: number of this sentence */
+#define GSV_INDEX_MSG_NUM           (2U)
+/* Index inside GSV NMEA of: first satellite, PRN, elevation, azimuth and SNR each */
+#define GSV_INDEX_FIRST_SAT         (4U)
+#define GSV_SAT_FIELDS              (4U)
 /* Index inside RMC NMEA of: UTC time */
 #define RMC_INDEX_TIME              (1U)
-/* Expected length of UTC time field */
-#define RMC_TIME_LEN                (9U)
-/* Index of seconds inside UTC time field */
-#define RMC_TIME_SECONDS_INDEX      (4U)
+/* Shortest UTC time field, hhmmss */
+#define RMC_TIME_MIN_LEN            (6U)
 /* Index inside RMC NMEA of: Status, V = Navigation receiver warning, A = Data valid */
 #define RMC_INDEX_FIX_STAT          (2U)
 /* Index inside RMC NMEA of: Speed over ground (knots) */
 #define RMC_INDEX_SPEED_K           (7U)
+/* Index inside VTG NMEA of: Speed over ground (knots) */
+#define VTG_INDEX_SPEED_K           (5U)
+/* Index inside VTG NMEA of: Mode, N = Data not valid */
+#define VTG_INDEX_MODE              (9U)
+/* Index inside GGA NMEA of: Fix quality, 0 = No fix */
+#define GGA_INDEX_QUALITY           (6U)
+/* Index inside GGA NMEA of: Satellites used */
+#define GGA_INDEX_SATS_USED         (7U)
 /* Index inside TXT NMEA of: Any ASCII text */
 #define TXT_INDEX_TEXT              (4U)
 
-#define GNSS_MODULE_START_PATH      ("/usr/bin/gnss_module_start.sh")
-#define UART_DEVICE                 ("/dev/ttyAMA1")
-/* aesd-gnssposget-driver TTY Line Discipline number */
-#define N_GNSSPOSGET                (20)
+/* Length of the status string handed out by gnssdata_get_status() */
+#define STATUS_STRING_LEN           (80U)
+/* 1 knot = 1852 m/h, speeds are parsed in thousandths of a knot */
+#define KNOT_M_PER_H                (1852U)
+#define S_PER_H                     (3600U)
+#define KNOT_FRACTION_DIGITS        (3U)
+/* Seconds of the UTC time field are parsed in milliseconds */
+#define UTC_FRACTION_DIGITS         (3U)
+/* Integer digits we take before a number could overflow U32 */
+#define FIXED_INT_DIGITS_MAX        (6U)
+/* Digits nmea_parse_uint() takes, 999999999 still fits an int */
+#define UINT_DIGITS_MAX             (9U)
+/* Epochs queued for gnssdata_pop_sample(), power of two. Over 6 s at 10 Hz */
+#define SAMPLE_QUEUE_LEN            (64U)
+/* Wait before opening the input again after it failed */
+#define INPUT_RETRY_MS              (1000)
 
 
 /* ---------------------------------------------  */
@@ -44,30 +73,31 @@
 /* ---------------------------------------------  */
 
 
-char status_string[80] = "Fix status: NA, Sattelites in view: NA, Signal strength: NA";
-struct status_packet
+/* Comma separated fields of one sentence, address first. Point into the sentence, not terminated */
+struct nmea_fields
 {
-    Boolean fix_valid; /* Determine signal validity only based on this */
-    Boolean sats_valid;
-    Boolean ant_valid;
-    /* Fixed length status string. Example: "Fix status: NA, Sattelites in view: NA, Signal strength: NA" */
-    char sats_nr[10];
-    char ant_strength[10];
+    const char *start[NMEA_MAX_FIELDS];
+    unsigned int len[NMEA_MAX_FIELDS];
+    unsigned int count;
 };
 
-struct speed_packet
+/* Decodes one sentence type into cur_sample, whichever talker sent it */
+struct nmea_handler
 {
-    double timestamp;
-    double speed;
+    char type[NMEA_TYPE_LEN + 1U];
+    void (*handle)(const struct nmea_fields *fields, S64 arrival_ns);
 };
 
-
-/* ---------------------------------------------  */
-/* Public variables declarations */
-/* ---------------------------------------------  */
-
-
- Boolean gnssdata_get_status_flag;
+/* GSV set being received, one talker and signal */
+struct gsv_assembly
+{
+    char talker[NMEA_TALKER_LEN];
+    U8 signal;
+    int total;
+    int next;           /* Sentence number we wait for, 0 when idle */
+    unsigned int count;
+    struct gnssdata_satellite sats[GNSSDATA_SATELLITES_MAX];
+};
 
 
 /* ---------------------------------------------  */
@@ -76,27 +106,65 @@ struct speed_packet
 
 
 static Boolean run_listener;
-static pthread_mutex_t nmea_buf_mutex;
-static pthread_mutex_t status_mutex;
-static pthread_mutex_t speed_mutex;
+static Boolean listener_running = FALSE;
 static pthread_t listener_thread;
-static struct status_packet cur_status = 
+/* A measurement session wants epochs queued and signalled */
+static atomic_bool subscribed;
+/* Wakes read_data_task out of poll() when stop is requested */
+static int stop_event_fd = -1;
+/* A session subscribed, a recording is played (again) for it */
+static int replay_event_fd = -1;
+/* Readable whenever a new epoch was published */
+static int epoch_event_fd = -1;
+
+static const struct gnssdata_snapshot empty_sample =
 {
+    .epoch = 0U,
+    .utc_ms = -1,
+    .speed_mmps = -1,
+    .arrival_ns = -1,
     .fix_valid = FALSE,
     .sats_valid = FALSE,
-    .ant_valid = FALSE,
-    .sats_nr = "NA",
-    .ant_strength = "NA"
-};
-static struct speed_packet cur_speed =
-{
-    .timestamp = -1.0,
-    .speed = -1.0
+    .sats_in_view = 0,
+    .sats_used_valid = FALSE,
+    .sats_used = 0,
+    .snr_valid = FALSE,
+    .snr_mean = 0,
+    .snr_min = 0,
+    .snr_max = 0,
+    .sats_tracked = 0,
+    .sats_strong = 0
 };
 
-static const char gptxt[] = "$GPTXT";
-static const char gpgsv[] = "$GPGSV";
-static const char gprmc[] = "$GPRMC";
+/* Built up by read_data_task only, nobody else touches it */
+static struct gnssdata_snapshot cur_sample;
+/* cur_sample is an epoch whose RMC had no speed, not queued until VTG had its say */
+static Boolean cur_sample_held;
+static struct gnssdata_sky cur_sky;
+static Boolean cur_sky_changed;
+static struct gsv_assembly gsv_set;
+
+/*
+ * Copy of cur_sample and cur_sky for everybody else. read_data_task is the single
+ * writer: published_seq is odd while it copies, readers retry when it was
+ * odd or changed under them. The writer never waits for readers.
+ */
+static struct gnssdata_snapshot published_sample;
+static struct gnssdata_sky published_sky;
+static atomic_uint published_seq;
+
+/*
+ * Every epoch in order, for the single consumer of gnssdata_pop_sample().
+ * read_data_task only moves sample_head, the consumer only sample_tail,
+ * both free running. A full queue drops the new epoch and counts it.
+ */
+static struct gnssdata_snapshot sample_queue[SAMPLE_QUEUE_LEN];
+static atomic_uint sample_head;
+static atomic_uint sample_tail;
+static atomic_uint sample_dropped;
+
+/* Well formed sentences without a handler, read_data_task only */
+static U32 unknown_sentences;
 
 
 
@@ -104,338 +172,981 @@ static const char gprmc[] = "$GPRMC";
 /* Private functions declarations */
 /* ---------------------------------------------  */
 static void read_data_task(void*);
-static void extract_nmea(char *buf);
-static void populate_status(void);
-static double parse_utc_to_seconds(const char *utc_str);
+static int read_input(const int *run_flag);
+static void wait_stop(int timeout_ms);
+static Boolean wait_replay(void);
+static void extract_nmea(const char *buf, S64 arrival_ns);
+static Boolean nmea_tokenize(const char *sentence, struct nmea_fields *fields);
+static const struct nmea_handler *nmea_find_handler(const struct nmea_fields *fields);
+static void handle_rmc(const struct nmea_fields *fields, S64 arrival_ns);
+static void handle_vtg(const struct nmea_fields *fields, S64 arrival_ns);
+static void handle_gga(const struct nmea_fields *fields, S64 arrival_ns);
+static void handle_gsv(const struct nmea_fields *fields, S64 arrival_ns);
+static void handle_txt(const struct nmea_fields *fields, S64 arrival_ns);
+static void gsv_commit(void);
+static void gsv_aggregate(void);
+static Boolean nmea_parse_uint(const char *str, unsigned int len, int *out);
+static Boolean nmea_parse_fixed(const char *str, unsigned int len, unsigned int frac_digits, U32 *out);
+static Boolean nmea_parse_utc(const char *str, unsigned int len, U32 *out);
+static S32 knots_to_mmps(U32 speed_mknots);
+static int hex_value(char c);
+static void publish_sample(void);
+static void published_copy(void *dst, const void *src, size_t size);
+static void queue_sample(void);
+static void commit_sample(void);
+static void format_status(const struct gnssdata_snapshot *sample, char *buf, size_t size);
+
+/* Sentence types we decode. The line discipline filter is built from it too */
+static const struct nmea_handler nmea_handlers[] =
+{
+    { "RMC", handle_rmc },
+    { "VTG", handle_vtg },
+    { "GGA", handle_gga },
+    { "GSV", handle_gsv },
+    { "TXT", handle_txt }
+};
+
+#define NMEA_HANDLERS_NUM           (sizeof(nmea_handlers) / sizeof(nmea_handlers[0]))
 
 /* ---------------------------------------------  */
 /* Public functions */
 /* ---------------------------------------------  */
 Boolean gnssdata_poll_status(void)
 {
-    Boolean result;
-    pthread_mutex_lock(&status_mutex);
-    result = cur_status.fix_valid;
-    pthread_mutex_unlock(&status_mutex);
+    struct gnssdata_snapshot sample;
 
-    return result;
+    gnssdata_get_snapshot(&sample);
+    return sample.fix_valid;
 }
 
 void gnssdata_get_status(char **buf)
 {
-    pthread_mutex_lock(&status_mutex);
-    *buf = malloc(strlen(status_string) + 1);
-    (void)strcpy((char*)*buf, (char*)status_string);
-    pthread_mutex_unlock(&status_mutex);
+    struct gnssdata_snapshot sample;
+
+    gnssdata_get_snapshot(&sample);
+    *buf = malloc(STATUS_STRING_LEN);
+    format_status(&sample, *buf, STATUS_STRING_LEN);
 }
 
-double gnssdata_get_timestamp(void)
+/* eventfd to poll() for new epochs while subscribed, -1 when gnssdata is stopped */
+int gnssdata_get_epoch_fd(void)
 {
-    double ret;
-    pthread_mutex_lock(&speed_mutex);
-    ret = cur_speed.timestamp;
-    pthread_mutex_unlock(&speed_mutex);
-    return ret;
+    return epoch_event_fd;
 }
 
-double gnssdata_get_speed(void)
+void gnssdata_get_snapshot(struct gnssdata_snapshot *snapshot)
 {
-    double ret;
-    pthread_mutex_lock(&speed_mutex);
-    ret = cur_speed.speed;
-    pthread_mutex_unlock(&speed_mutex);
-    ret *= 1.852; /* Convert from knots to km/h */
-    return ret;
+    published_copy(snapshot, &published_sample, sizeof(*snapshot));
 }
 
+void gnssdata_get_sky(struct gnssdata_sky *sky)
+{
+    published_copy(sky, &published_sky, sizeof(*sky));
+}
+
+/* Oldest epoch not handed out yet. FALSE when there is none */
+Boolean gnssdata_pop_sample(struct gnssdata_snapshot *sample)
+{
+    unsigned int tail = atomic_load_explicit(&sample_tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&sample_head, memory_order_acquire))
+    {
+        return FALSE;
+    }
+
+    *sample = sample_queue[tail & (SAMPLE_QUEUE_LEN - 1U)];
+    atomic_store_explicit(&sample_tail, tail + 1U, memory_order_release);
+    return TRUE;
+}
+
+/* Consumer side: forget queued epochs and the dropped count */
+void gnssdata_flush_samples(void)
+{
+    atomic_store_explicit(&sample_tail, atomic_load_explicit(&sample_head, memory_order_acquire), memory_order_release);
+    atomic_store_explicit(&sample_dropped, 0U, memory_order_relaxed);
+}
+
+/* Epochs lost to a full queue since the last flush */
+U32 gnssdata_get_dropped_samples(void)
+{
+    return atomic_load_explicit(&sample_dropped, memory_order_relaxed);
+}
+
+/*
+ * Brings up the input and keeps reading it until gnssdata_stop(), once per
+ * process. Measurement sessions come and go with gnssdata_subscribe().
+ */
 void gnssdata_start()
 {
     aesdlog_dbg_info("gnssdata_start");
+    if (listener_running == TRUE)
+    {
+        return;
+    }
+
     run_listener = TRUE;
     
     /* Invalidate previous fix status data */
-    cur_status.fix_valid = FALSE;
-    cur_status.sats_valid = FALSE;
-    cur_status.ant_valid = FALSE;
+    cur_sample = empty_sample;
+    cur_sample_held = FALSE;
+    cur_sky.epoch = 0U;
+    cur_sky.count = 0U;
+    cur_sky_changed = TRUE;
+    gsv_set.next = 0;
+    publish_sample();
+    atomic_store_explicit(&subscribed, FALSE, memory_order_relaxed);
+    gnssdata_flush_samples();
+
+    stop_event_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_event_fd < 0)
+    {
+        aesdlog_err("eventfd: %s", strerror(errno));
+    }
 
-    gnssdata_get_status_flag = TRUE;
-    pthread_mutex_init(&nmea_buf_mutex, NULL);
-    pthread_mutex_init(&status_mutex, NULL);
-    pthread_mutex_init(&speed_mutex, NULL);
+    epoch_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoch_event_fd < 0)
+    {
+        aesdlog_err("eventfd: %s", strerror(errno));
+    }
+
+    replay_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (replay_event_fd < 0)
+    {
+        aesdlog_err("eventfd: %s", strerror(errno));
+    }
 
     aesdlog_dbg_info("gnssdata_start(): Starting listener thread");
     pthread_create(&listener_thread, NULL, (void*)read_data_task, (void*)&run_listener);
+    listener_running = TRUE;
 }
 
 void gnssdata_stop()
 {
     aesdlog_dbg_info("gnssdata_stop");
+    if (listener_running == FALSE)
+    {
+        return;
+    }
+
     run_listener = FALSE;
+    gnssdata_unsubscribe();
+    if (stop_event_fd >= 0)
+    {
+        /* Don't wait for the next sentence to notice run_listener */
+        (void)eventfd_write(stop_event_fd, 1);
+    }
 
-    gnssdata_get_status_flag = FALSE;
     pthread_join(listener_thread, NULL);
-    pthread_mutex_destroy(&nmea_buf_mutex);
-    pthread_mutex_destroy(&status_mutex);
-    pthread_mutex_destroy(&speed_mutex);
+    listener_running = FALSE;
+    if (stop_event_fd >= 0)
+    {
+        close(stop_event_fd);
+        stop_event_fd = -1;
+    }
+
+    if (epoch_event_fd >= 0)
+    {
+        close(epoch_event_fd);
+        epoch_event_fd = -1;
+    }
+
+    if (replay_event_fd >= 0)
+    {
+        close(replay_event_fd);
+        replay_event_fd = -1;
+    }
+
     aesdlog_info("accelmeter - leaving gnssdata_stop()");
 }
 
+/*
+ * Starts a measurement session on the running reader: epochs from now on
+ * are queued for gnssdata_pop_sample() and signalled on the epoch eventfd.
+ * The fix and sky kept by the reader are not touched. A recording is
+ * played from its start for every session, see gnssinput_is_recording().
+ */
+void gnssdata_subscribe(void)
+{
+    gnssdata_flush_samples();
+    atomic_store_explicit(&subscribed, TRUE, memory_order_release);
+    if ((gnssinput_is_recording() == TRUE) && (replay_event_fd >= 0))
+    {
+        (void)eventfd_write(replay_event_fd, 1);
+    }
+}
+
+/* Ends the session, the reader goes on keeping the fix */
+void gnssdata_unsubscribe(void)
+{
+    eventfd_t count;
+
+    atomic_store_explicit(&subscribed, FALSE, memory_order_release);
+    gnssdata_flush_samples();
+    if (epoch_event_fd >= 0)
+    {
+        /* Nothing left for the next session to wake up on */
+        (void)eventfd_read(epoch_event_fd, &count);
+    }
+}
+
 /* ---------------------------------------------  */
 /* Private functions */
 /* ---------------------------------------------  */
+/*
+ * Reader thread, lives from gnssdata_start() to gnssdata_stop(). An input
+ * that fails is opened again, so the receiver keeps its fix across
+ * sessions and comes back after an unplugged cable. A recording waits for
+ * a session instead, played unsubscribed it would be over before anybody
+ * got an epoch out of it.
+ */
 static void read_data_task(void* arg)
 {
     int *run_flag = arg;
-    int fd;
-    int read_count = 0;
-    int ldisc = N_GNSSPOSGET;
-    char buffer[256];
+    int ret;
+    struct gnssposget_filter filter;
+    unsigned int i;
 
-    aesdlog_dbg_info("Setting up UART port %s", UART_DEVICE);
-    if (system(GNSS_MODULE_START_PATH) != 0) {
-        aesdlog_err("Failed to set up GNSS module");
-        *run_flag = FALSE;
-    }
-
-    aesdlog_dbg_info("Opening UART port %s", UART_DEVICE);
-    fd = open(UART_DEVICE, O_RDONLY | O_NOCTTY);
-    if (fd < 0) {
-        aesdlog_err("open: %s", strerror(errno));
-        *run_flag = FALSE;
-    }
+    unknown_sentences = 0U;
 
-    aesdlog_dbg_info("Attaching to TTY Line Discipline");
-    if (ioctl(fd, TIOCSETD, &ldisc) < 0) {
-        aesdlog_err("ioctl(TIOCSETD): %s", strerror(errno));
-        close(fd);
-        *run_flag = FALSE;
+    /* Pass our sentence types from any talker, "--RMC" takes GPRMC, GNRMC... */
+    (void)memset(&filter, 0, sizeof(filter));
+    for (i = 0U; i < NMEA_HANDLERS_NUM; i++)
+    {
+        filter.addr[i][0] = '-';
+        filter.addr[i][1] = '-';
+        (void)memcpy(&filter.addr[i][NMEA_TALKER_LEN], nmea_handlers[i].type, NMEA_TYPE_LEN);
+        filter.count++;
     }
 
-    aesdlog_info("read_data_task(): Attached line discipline %d to %s", ldisc, UART_DEVICE);
-    while(1)
+    while (*run_flag == TRUE)
     {
-        if (*run_flag == FALSE)
+        if ((gnssinput_is_recording() == TRUE) && (wait_replay() == FALSE))
         {
-            break;
+            continue;
         }
 
-        pthread_mutex_lock(&nmea_buf_mutex);
-        int ret = read(fd, (char *)(buffer + read_count), (sizeof(buffer) - read_count));
-        if (ret < 0)
+        if (gnssinput_open(extract_nmea, &filter) == FALSE)
         {
-            aesdlog_err("UART read data error: %s", strerror(errno));
-            *run_flag = FALSE;
-            pthread_mutex_unlock(&nmea_buf_mutex);
+            aesdlog_err("read_data_task(): Failed to open %s", gnssinput_get_name());
+            wait_stop(INPUT_RETRY_MS);
+            continue;
         }
-        else if (ret == 0)
+
+        ret = read_input(run_flag);
+        gnssinput_close();
+
+        /* Whatever the receiver said last is not true anymore */
+        cur_sample = empty_sample;
+        cur_sample_held = FALSE;
+        publish_sample();
+
+        if (ret == 0)
         {
-            aesdlog_info("read_data_task(): received nothing");
-            *run_flag = FALSE;
-            pthread_mutex_unlock(&nmea_buf_mutex);
+            /* Recording ended, the next session plays it again */
+            aesdlog_info("read_data_task(): end of %s", gnssinput_get_name());
         }
-        else
+        else if (ret < 0)
         {
-            /* Check for end of NMEA sentence (ret - 1 = \0) */
-            if ((buffer[read_count + (ret - 2)] == '\r') || (buffer[read_count + (ret - 2)] == '\n'))
-            {
-                /* Default case: stop reading before start of checksum */
-                char *checksum_start = strchr((const char *)buffer, '*');
-                if (checksum_start)
-                {
-                    /* End string before checksum symbol */
-                    *checksum_start = '\0';
-                }
-
-                pthread_mutex_unlock(&nmea_buf_mutex);
-                extract_nmea(buffer);
-                read_count = 0;
-            }
-            else
-            {
-                // aesdlog_dbg_info("buffer without trailing \\r or \\n");
-                read_count += ret;
-                pthread_mutex_unlock(&nmea_buf_mutex);
-            }
+            wait_stop(INPUT_RETRY_MS);
         }
     }
     
-    close(fd);
+    if (unknown_sentences != 0U)
+    {
+        aesdlog_info("read_data_task(): skipped %lu unsupported sentences", (unsigned long)unknown_sentences);
+    }
+
     aesdlog_info("accelmeter-app - closing listener_thread");
 }
 
-static void extract_nmea(char *buf)
+/*
+ * Reads the open input until stop is requested or a new session wants the
+ * recording from its start (1), it ends (0) or fails (-1)
+ */
+static int read_input(const int *run_flag)
 {
-    char *parsed_buf, *parsed_buf_ptr, *token;
-    unsigned int index = 0;
-    pthread_mutex_lock(&nmea_buf_mutex);
-    int buf_len = strlen(buf);
-    parsed_buf = malloc(buf_len + 1);
-    (void)strcpy((char*)parsed_buf, (char*)buf);
-    pthread_mutex_unlock(&nmea_buf_mutex);
+    int ret, timeout_ms;
+    struct pollfd fds[3];
 
-    /* Check which message we got */
-    parsed_buf_ptr = parsed_buf;
-    // aesdlog_dbg_info("*parsed_buf=%s", parsed_buf);
-    if (strncmp(parsed_buf, gpgsv, NMEA_ADDR_LEN) == 0)
+    fds[1].fd = stop_event_fd;
+    fds[1].events = POLLIN;
+    /* Left pending for wait_replay() */
+    fds[2].fd = (gnssinput_is_recording() == TRUE) ? replay_event_fd : -1;
+    fds[2].events = POLLIN;
+    while (*run_flag == TRUE)
     {
-        /* -------------------------------------------------------- */
-        /* Parse GSV */
-        /* -------------------------------------------------------- */
-        /* Just skip this message if status is not needed */
-        pthread_mutex_lock(&status_mutex);
-        if (gnssdata_get_status_flag == TRUE)
+        /* Sleep until there are sentences or we are asked to stop */
+        fds[0].fd = gnssinput_poll_fd(&timeout_ms);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        if (poll(fds, 3, timeout_ms) < 0)
         {
-            while((token = (strsep(&parsed_buf_ptr, ","))) != NULL)
+            if (errno != EINTR)
             {
-                if (index == GSV_INDEX_SAT_COUNT)
-                {
-                    cur_status.sats_valid = FALSE;
-                    if (*token != '\0')
-                    {
-                        (void)strcpy((char*)cur_status.sats_nr, (char*)token);
-                        cur_status.sats_valid = TRUE;
-                    }
-                }
-                else if (index == GSV_INDEX_ANT_STR)
-                {
-                    cur_status.ant_valid = FALSE;
-                    if (*token != '\0')
-                    {
-                        (void)strcpy((char*)cur_status.ant_strength, (char*)token);
-                        cur_status.ant_valid = TRUE;
-                    }
-
-                    /* We can break after this one */
-                    break;
-                }
-                else
-                {
-                    /* Do nothing */
-                }
-
-                index++;
+                aesdlog_err("poll: %s", strerror(errno));
+                return -1;
             }
 
-            populate_status();
+            continue;
         }
 
-        pthread_mutex_unlock(&status_mutex);
+        if ((fds[1].revents & POLLIN) || (fds[2].revents & POLLIN))
+        {
+            break;
+        }
+
+        if (fds[0].revents & (POLLERR | POLLNVAL))
+        {
+            aesdlog_err("read_data_task(): %s closed", gnssinput_get_name());
+            return -1;
+        }
+
+        /* Sentences go to extract_nmea() */
+        ret = gnssinput_read();
+        if (ret <= 0)
+        {
+            return ret;
+        }
     }
-    
-    else if (strncmp(parsed_buf, gprmc, NMEA_ADDR_LEN) == 0)
+
+    return 1;
+}
+
+/* Sleeps timeout_ms, -1 for ever, or until gnssdata_stop() */
+static void wait_stop(int timeout_ms)
+{
+    struct pollfd fds[1];
+
+    fds[0].fd = stop_event_fd;
+    fds[0].events = POLLIN;
+    (void)poll(fds, 1, timeout_ms);
+}
+
+/* Sleeps until a session subscribes. FALSE when gnssdata_stop() came first */
+static Boolean wait_replay(void)
+{
+    struct pollfd fds[2];
+    eventfd_t count;
+    int ret;
+
+    if (replay_event_fd < 0)
+    {
+        /* No way to tell, play right away */
+        return TRUE;
+    }
+
+    fds[0].fd = stop_event_fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = replay_event_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    do
+    {
+        ret = poll(fds, 2, -1);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (fds[0].revents & POLLIN)
+    {
+        return FALSE;
+    }
+
+    (void)eventfd_read(replay_event_fd, &count);
+    return TRUE;
+}
+
+static void extract_nmea(const char *buf, S64 arrival_ns)
+{
+    struct nmea_fields fields;
+    const struct nmea_handler *handler;
+
+    if (nmea_tokenize(buf, &fields) == FALSE)
+    {
+        aesdlog_err("Dropping corrupted NMEA sentence: %s", buf);
+        return;
+    }
+
+    handler = nmea_find_handler(&fields);
+    if (handler == NULL)
+    {
+        /* Not one we decode. Count it and carry on */
+        unknown_sentences++;
+        aesdlog_dbg_info("Skipping unsupported message from GNSS: %s", buf);
+        return;
+    }
+
+    handler->handle(&fields, arrival_ns);
+}
+
+/*
+ * Walks the sentence once: splits it into fields in place and
+ * checks the *hh checksum, XOR of everything between '$' and '*'.
+ * Returns FALSE if the sentence is corrupted.
+ */
+static Boolean nmea_tokenize(const char *sentence, struct nmea_fields *fields)
+{
+    const char *ptr;
+    U8 sum = 0U;
+    int hi, lo;
+
+    if (sentence[0] != '$')
     {
-        /* -------------------------------------------------------- */
-        /* Parse RMC */
-        /* -------------------------------------------------------- */
-        while((token = (strsep(&parsed_buf_ptr, ","))) != NULL)
+        return FALSE;
+    }
+
+    fields->count = 0U;
+    fields->start[0] = &sentence[1];
+    for (ptr = &sentence[1]; *ptr != '*'; ptr++)
+    {
+        if ((*ptr == '\0') || (*ptr == '\r') || (*ptr == '\n'))
         {
-            if (index == RMC_INDEX_TIME)
-            {
-                pthread_mutex_lock(&speed_mutex);
-                cur_speed.timestamp = -1.0;
-                if (strlen(token) == RMC_TIME_LEN)
-                {
-                    cur_speed.timestamp = parse_utc_to_seconds(token);
-                }
-
-                pthread_mutex_unlock(&speed_mutex);
-            }
-            else if (index == RMC_INDEX_FIX_STAT)
-            {
-                pthread_mutex_lock(&status_mutex);
-                if (gnssdata_get_status_flag == TRUE)
-                {
-                    cur_status.fix_valid = FALSE;
-                    if (*token != '\0')
-                    {
-                        /* A=Autonomous GNSS Fix, D=Differential GNSS Fix */
-                        if ((*token == 'A') || (*token == 'D'))
-                        {
-                            cur_status.fix_valid = TRUE;
-                        }
-                    }
-
-                    populate_status();
-                }
-
-                pthread_mutex_unlock(&status_mutex);
-            }
-            else if (index == RMC_INDEX_SPEED_K)
+            /* No checksum */
+            return FALSE;
+        }
+
+        sum ^= (U8)*ptr;
+        if ((*ptr == ',') && (fields->count < NMEA_MAX_FIELDS))
+        {
+            fields->len[fields->count] = ptr - fields->start[fields->count];
+            fields->count++;
+            if (fields->count < NMEA_MAX_FIELDS)
             {
-                pthread_mutex_lock(&speed_mutex);
-                cur_speed.speed = -1.0;
-                if (*token != '\0')
-                {
-                    if ((cur_speed.speed = atof(token)) <= 0)
-                    {
-                        cur_speed.speed = -1.0;
-                        aesdlog_err("Speed Invalid!: %s", token);
-                        /* Speed invalid */
-                    }
-                }
-
-                pthread_mutex_unlock(&speed_mutex);
+                fields->start[fields->count] = ptr + 1;
             }
-            else
+        }
+    }
+
+    if (fields->count < NMEA_MAX_FIELDS)
+    {
+        fields->len[fields->count] = ptr - fields->start[fields->count];
+        fields->count++;
+    }
+
+    if (((hi = hex_value(ptr[1])) < 0) || ((lo = hex_value(ptr[2])) < 0))
+    {
+        return FALSE;
+    }
+
+    return (sum == (U8)((hi << 4) | lo)) ? TRUE : FALSE;
+}
+
+/* Handler for the sentence type in the address, whatever the talker. NULL if we have none */
+static const struct nmea_handler *nmea_find_handler(const struct nmea_fields *fields)
+{
+    unsigned int i;
+
+    if (fields->len[0] != NMEA_ADDR_LEN)
+    {
+        return NULL;
+    }
+
+    for (i = 0U; i < NMEA_HANDLERS_NUM; i++)
+    {
+        if (memcmp(&fields->start[0][NMEA_TALKER_LEN], nmea_handlers[i].type, NMEA_TYPE_LEN) == 0)
+        {
+            return &nmea_handlers[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Time, fix status and speed. Every RMC closes an epoch */
+static void handle_rmc(const struct nmea_fields *fields, S64 arrival_ns)
+{
+    struct timespec now;
+    U32 utc_ms, speed_mknots;
+
+    if (cur_sample_held == TRUE)
+    {
+        /* No VTG came for the last epoch, it goes out without speed */
+        commit_sample();
+    }
+
+    cur_sample.epoch++;
+    cur_sample.arrival_ns = arrival_ns;
+    cur_sample.utc_ms = -1;
+    if ((fields->count > RMC_INDEX_TIME) &&
+        (nmea_parse_utc(fields->start[RMC_INDEX_TIME], fields->len[RMC_INDEX_TIME], &utc_ms) == TRUE))
+    {
+        cur_sample.utc_ms = (S32)utc_ms;
+    }
+
+    /* Standing still is 0, only an empty or garbled field leaves the speed unknown */
+    cur_sample.speed_mmps = -1;
+    if ((fields->count > RMC_INDEX_SPEED_K) &&
+        (nmea_parse_fixed(fields->start[RMC_INDEX_SPEED_K], fields->len[RMC_INDEX_SPEED_K],
+                          KNOT_FRACTION_DIGITS, &speed_mknots) == TRUE))
+    {
+        cur_sample.speed_mmps = knots_to_mmps(speed_mknots);
+    }
+
+    /* Always tracked, a session starts right away when there is a fix. A=Autonomous, D=Differential */
+    cur_sample.fix_valid = ((fields->count > RMC_INDEX_FIX_STAT) &&
+                            (fields->len[RMC_INDEX_FIX_STAT] == 1U) &&
+                            ((fields->start[RMC_INDEX_FIX_STAT][0] == 'A') ||
+                             (fields->start[RMC_INDEX_FIX_STAT][0] == 'D'))) ? TRUE : FALSE;
+
+    /* Time, speed and fix of one epoch go out together */
+    publish_sample();
+    if (cur_sample.speed_mmps >= 0)
+    {
+        commit_sample();
+    }
+    else
+    {
+        /* VTG right after may have the speed */
+        cur_sample_held = TRUE;
+    }
+
+    /* Time spent between UART and here */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    aesdlog_dbg_info("RMC %.*s pipeline latency %lld us",
+                     (int)fields->len[RMC_INDEX_TIME], fields->start[RMC_INDEX_TIME],
+                     ((((S64)now.tv_sec * 1000000000LL) + now.tv_nsec) - arrival_ns) / 1000LL);
+}
+
+/*
+ * Course and speed, sent right after RMC. Fills in the speed of an epoch
+ * whose RMC had none, then lets the held epoch go to the queue.
+ */
+static void handle_vtg(const struct nmea_fields *fields, S64 arrival_ns)
+{
+    U32 speed_mknots;
+    Boolean valid;
+
+    (void)arrival_ns;
+    if (cur_sample_held == FALSE)
+    {
+        /* RMC had the speed, the epoch is queued already */
+        return;
+    }
+
+    /* Mode N: the receiver says it's not valid */
+    valid = ((fields->count > VTG_INDEX_MODE) && (fields->len[VTG_INDEX_MODE] == 1U) &&
+             (fields->start[VTG_INDEX_MODE][0] == 'N')) ? FALSE : TRUE;
+    if ((valid == TRUE) && (fields->count > VTG_INDEX_SPEED_K) &&
+        (nmea_parse_fixed(fields->start[VTG_INDEX_SPEED_K], fields->len[VTG_INDEX_SPEED_K],
+                          KNOT_FRACTION_DIGITS, &speed_mknots) == TRUE))
+    {
+        cur_sample.speed_mmps = knots_to_mmps(speed_mknots);
+        publish_sample();
+    }
+
+    commit_sample();
+}
+
+/* Satellites used while there is a fix */
+static void handle_gga(const struct nmea_fields *fields, S64 arrival_ns)
+{
+    int quality, sats_used;
+
+    (void)arrival_ns;
+
+    cur_sample.sats_used_valid = FALSE;
+    if ((fields->count > GGA_INDEX_SATS_USED) &&
+        (nmea_parse_uint(fields->start[GGA_INDEX_QUALITY], fields->len[GGA_INDEX_QUALITY], &quality) == TRUE) &&
+        (nmea_parse_uint(fields->start[GGA_INDEX_SATS_USED], fields->len[GGA_INDEX_SATS_USED], &sats_used) == TRUE) &&
+        (quality > 0))
+    {
+        cur_sample.sats_used_valid = TRUE;
+        cur_sample.sats_used = sats_used;
+    }
+
+    publish_sample();
+}
+
+/*
+ * Satellites in view. A set is one to four sentences per talker (and
+ * signal), its satellites replace that talker's ones in cur_sky once the
+ * last sentence arrived. A missing sentence drops the set.
+ */
+static void handle_gsv(const struct nmea_fields *fields, S64 arrival_ns)
+{
+    int total, num, prn, val;
+    unsigned int i, groups;
+    U8 signal = 0U;
+    struct gnssdata_satellite *sat;
+
+    (void)arrival_ns;
+
+    if ((fields->count < GSV_INDEX_FIRST_SAT) ||
+        (nmea_parse_uint(fields->start[GSV_INDEX_MSG_TOTAL], fields->len[GSV_INDEX_MSG_TOTAL], &total) == FALSE) ||
+        (nmea_parse_uint(fields->start[GSV_INDEX_MSG_NUM], fields->len[GSV_INDEX_MSG_NUM], &num) == FALSE) ||
+        (num < 1) || (num > total))
+    {
+        return;
+    }
+
+    /* NMEA 4.10 adds the signal ID after the satellites */
+    groups = (fields->count - GSV_INDEX_FIRST_SAT) / GSV_SAT_FIELDS;
+    if ((((fields->count - GSV_INDEX_FIRST_SAT) % GSV_SAT_FIELDS) == 1U) && (fields->len[fields->count - 1U] == 1U) &&
+        ((val = hex_value(fields->start[fields->count - 1U][0])) >= 0))
+    {
+        signal = (U8)val;
+    }
+
+    if (num == 1)
+    {
+        (void)memcpy(gsv_set.talker, fields->start[0], NMEA_TALKER_LEN);
+        gsv_set.signal = signal;
+        gsv_set.total = total;
+        gsv_set.count = 0U;
+    }
+    else if ((num != gsv_set.next) || (total != gsv_set.total) || (signal != gsv_set.signal) ||
+             (memcmp(gsv_set.talker, fields->start[0], NMEA_TALKER_LEN) != 0))
+    {
+        /* Not the sentence we were waiting for, wait for the next set */
+        gsv_set.next = 0;
+        return;
+    }
+
+    for (i = 0U; i < groups; i++)
+    {
+        unsigned int f = GSV_INDEX_FIRST_SAT + (i * GSV_SAT_FIELDS);
+
+        if ((gsv_set.count >= GNSSDATA_SATELLITES_MAX) ||
+            (nmea_parse_uint(fields->start[f], fields->len[f], &prn) == FALSE))
+        {
+            continue;
+        }
+
+        sat = &gsv_set.sats[gsv_set.count++];
+        (void)memcpy(sat->talker, gsv_set.talker, NMEA_TALKER_LEN);
+        sat->signal = signal;
+        sat->prn = (U16)prn;
+        sat->elevation = (nmea_parse_uint(fields->start[f + 1U], fields->len[f + 1U], &val) == TRUE) ? (S16)val : -1;
+        sat->azimuth = (nmea_parse_uint(fields->start[f + 2U], fields->len[f + 2U], &val) == TRUE) ? (S16)val : -1;
+        sat->snr = (nmea_parse_uint(fields->start[f + 3U], fields->len[f + 3U], &val) == TRUE) ? (U8)val : 0U;
+    }
+
+    gsv_set.next = num + 1;
+    if (num == total)
+    {
+        gsv_set.next = 0;
+        gsv_commit();
+        publish_sample();
+    }
+}
+
+static void handle_txt(const struct nmea_fields *fields, S64 arrival_ns)
+{
+    (void)arrival_ns;
+    if ((fields->count > TXT_INDEX_TEXT) && (fields->len[TXT_INDEX_TEXT] != 0U))
+    {
+        /* Got TXT message. Send it to syslog */
+        aesdlog_info("Received text message from GNSS: %.*s", (int)fields->len[TXT_INDEX_TEXT], fields->start[TXT_INDEX_TEXT]);
+    }
+}
+
+/* Whole field as unsigned decimal integer, FALSE for more than UINT_DIGITS_MAX digits */
+static Boolean nmea_parse_uint(const char *str, unsigned int len, int *out)
+{
+    unsigned int i;
+    int val = 0;
+
+    if ((len == 0U) || (len > UINT_DIGITS_MAX))
+    {
+        return FALSE;
+    }
+
+    for (i = 0U; i < len; i++)
+    {
+        if ((str[i] < '0') || (str[i] > '9'))
+        {
+            return FALSE;
+        }
+
+        val = (val * 10) + (str[i] - '0');
+    }
+
+    *out = val;
+    return TRUE;
+}
+
+/*
+ * Whole field as unsigned fixed point number: "ddd.ddd" times 10^frac_digits.
+ * Missing fraction digits count as zeros, further ones are cut off.
+ */
+static Boolean nmea_parse_fixed(const char *str, unsigned int len, unsigned int frac_digits, U32 *out)
+{
+    unsigned int i;
+    unsigned int int_digits = 0U;
+    unsigned int digits = 0U;
+    U32 val = 0U;
+    Boolean fraction = FALSE;
+
+    if (len == 0U)
+    {
+        return FALSE;
+    }
+
+    for (i = 0U; i < len; i++)
+    {
+        if ((str[i] == '.') && (fraction == FALSE))
+        {
+            fraction = TRUE;
+            continue;
+        }
+
+        if ((str[i] < '0') || (str[i] > '9'))
+        {
+            return FALSE;
+        }
+
+        digits++;
+        if (fraction == FALSE)
+        {
+            if (++int_digits > FIXED_INT_DIGITS_MAX)
             {
-                /* Do nothing */
+                return FALSE;
             }
+        }
+        else if (frac_digits == 0U)
+        {
+            /* Beyond the resolution we want, still has to be a digit */
+            continue;
+        }
+        else
+        {
+            frac_digits--;
+        }
+
+        val = (val * 10U) + (U32)(str[i] - '0');
+    }
+
+    if (digits == 0U)
+    {
+        /* Just a '.' */
+        return FALSE;
+    }
 
-            index++;
+    for (; frac_digits > 0U; frac_digits--)
+    {
+        val *= 10U;
+    }
+
+    *out = val;
+    return TRUE;
+}
+
+/* UTC time field "hhmmss.ss" to milliseconds since midnight */
+static Boolean nmea_parse_utc(const char *str, unsigned int len, U32 *out)
+{
+    int hh, mm;
+    U32 ss_ms;
+
+    if ((len < RMC_TIME_MIN_LEN) ||
+        (nmea_parse_uint(&str[0], 2U, &hh) == FALSE) ||
+        (nmea_parse_uint(&str[2], 2U, &mm) == FALSE) ||
+        (nmea_parse_fixed(&str[4], len - 4U, UTC_FRACTION_DIGITS, &ss_ms) == FALSE))
+    {
+        return FALSE;
+    }
+
+    *out = ((U32)hh * 3600000U) + ((U32)mm * 60000U) + ss_ms;
+    return TRUE;
+}
+
+/* Puts the completed gsv_set in place of its talker's satellites in cur_sky */
+static void gsv_commit(void)
+{
+    unsigned int i, count = 0U;
+
+    for (i = 0U; i < cur_sky.count; i++)
+    {
+        if ((memcmp(cur_sky.sats[i].talker, gsv_set.talker, NMEA_TALKER_LEN) != 0) ||
+            (cur_sky.sats[i].signal != gsv_set.signal))
+        {
+            cur_sky.sats[count++] = cur_sky.sats[i];
         }
     }
-    else if (strncmp(parsed_buf, gptxt, NMEA_ADDR_LEN) == 0)
+
+    for (i = 0U; (i < gsv_set.count) && (count < GNSSDATA_SATELLITES_MAX); i++)
+    {
+        cur_sky.sats[count++] = gsv_set.sats[i];
+    }
+
+    cur_sky.count = count;
+    cur_sky.epoch = cur_sample.epoch;
+    cur_sky_changed = TRUE;
+    gsv_aggregate();
+}
+
+/* Satellite counts and SNR figures of cur_sky into cur_sample */
+static void gsv_aggregate(void)
+{
+    unsigned int i, j;
+    int snr_sum = 0;
+    const struct gnssdata_satellite *sat;
+
+    cur_sample.sats_in_view = 0;
+    cur_sample.sats_tracked = 0;
+    cur_sample.sats_strong = 0;
+    cur_sample.snr_min = 0;
+    cur_sample.snr_max = 0;
+    for (i = 0U; i < cur_sky.count; i++)
     {
-        /* -------------------------------------------------------- */
-        /* Parse TXT */
-        /* -------------------------------------------------------- */
+        sat = &cur_sky.sats[i];
 
-        while((token = (strsep(&parsed_buf_ptr, ","))) != NULL)
+        /* A satellite sending several signals is still one satellite */
+        for (j = 0U; j < i; j++)
         {
-            if (index == TXT_INDEX_TEXT)
+            if ((cur_sky.sats[j].prn == sat->prn) &&
+                (memcmp(cur_sky.sats[j].talker, sat->talker, NMEA_TALKER_LEN) == 0))
             {
-                if (*token != '\0')
-                {
-                    /* Got TXT message. Send it to syslog */
-                    aesdlog_info("Received text message from GNSS: %s", token);
-                }
+                break;
             }
+        }
+
+        if (j == i)
+        {
+            cur_sample.sats_in_view++;
+        }
+
+        if (sat->snr == 0U)
+        {
+            continue;
+        }
+
+        if ((cur_sample.sats_tracked == 0) || (sat->snr < cur_sample.snr_min))
+        {
+            cur_sample.snr_min = sat->snr;
+        }
+
+        if (sat->snr > cur_sample.snr_max)
+        {
+            cur_sample.snr_max = sat->snr;
+        }
 
-            index++;
+        if (sat->snr >= GNSSDATA_SNR_STRONG)
+        {
+            cur_sample.sats_strong++;
         }
+
+        snr_sum += sat->snr;
+        cur_sample.sats_tracked++;
     }
-    else
+
+    cur_sample.sats_valid = TRUE;
+    cur_sample.snr_valid = (cur_sample.sats_tracked > 0) ? TRUE : FALSE;
+    cur_sample.snr_mean = (cur_sample.sats_tracked > 0) ?
+                          ((snr_sum + (cur_sample.sats_tracked / 2)) / cur_sample.sats_tracked) : 0;
+}
+
+/* Thousandths of a knot to millimetres per second, rounded */
+static S32 knots_to_mmps(U32 speed_mknots)
+{
+    return (S32)((((U64)speed_mknots * KNOT_M_PER_H) + (S_PER_H / 2U)) / S_PER_H);
+}
+
+static int hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+
+    if ((c >= 'A') && (c <= 'F'))
     {
-        /* We received meesage that was not expected! */
-        free(parsed_buf);
-        aesdlog_err("ERROR! Unsupported message received from GNSS: %s", parsed_buf);
-        gnssdata_stop();
+        return c - 'A' + 10;
     }
 
-    free(parsed_buf);
+    if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+
+    return -1;
 }
 
-static void populate_status()
+/* Makes cur_sample and cur_sky visible to gnssdata_get_snapshot() and gnssdata_get_sky() */
+static void publish_sample(void)
 {
-    sprintf(status_string, "%s%s%s%s%s%s", 
-        "Fix status: ",
-        ((cur_status.fix_valid == TRUE) ? "OK" : "NA"),
-        ", Sattelites in view: ",
-        ((cur_status.sats_valid == TRUE) ? cur_status.sats_nr : "NA"),
-        ", Signal strength: ",
-        ((cur_status.ant_valid == TRUE) ? cur_status.ant_strength : "NA"));
+    unsigned int seq = atomic_load_explicit(&published_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&published_seq, seq + 1U, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    published_sample = cur_sample;
+    if (cur_sky_changed == TRUE)
+    {
+        /* Only copy the satellites when there are new ones */
+        published_sky = cur_sky;
+        cur_sky_changed = FALSE;
+    }
+    atomic_store_explicit(&published_seq, seq + 2U, memory_order_release);
+}
+
+/* Reader side of published_seq: consistent copy of a published_* variable */
+static void published_copy(void *dst, const void *src, size_t size)
+{
+    unsigned int seq_before, seq_after;
+
+    do
+    {
+        seq_before = atomic_load_explicit(&published_seq, memory_order_acquire);
+        if (seq_before & 1U)
+        {
+            /* Writer is in the middle of a copy */
+            sched_yield();
+            continue;
+        }
+
+        (void)memcpy(dst, src, size);
+        atomic_thread_fence(memory_order_acquire);
+        seq_after = atomic_load_explicit(&published_seq, memory_order_relaxed);
+    } while ((seq_before & 1U) || (seq_before != seq_after));
+}
+
+/* Appends cur_sample to sample_queue */
+/* cur_sample is final: queue and signal it while somebody is measuring */
+static void commit_sample(void)
+{
+    cur_sample_held = FALSE;
+    if (atomic_load_explicit(&subscribed, memory_order_acquire) == TRUE)
+    {
+        queue_sample();
+        if (epoch_event_fd >= 0)
+        {
+            (void)eventfd_write(epoch_event_fd, 1);
+        }
+    }
+}
+
+static void queue_sample(void)
+{
+    unsigned int head = atomic_load_explicit(&sample_head, memory_order_relaxed);
+
+    if ((head - atomic_load_explicit(&sample_tail, memory_order_acquire)) >= SAMPLE_QUEUE_LEN)
+    {
+        atomic_fetch_add_explicit(&sample_dropped, 1U, memory_order_relaxed);
+        return;
+    }
+
+    sample_queue[head & (SAMPLE_QUEUE_LEN - 1U)] = cur_sample;
+    atomic_store_explicit(&sample_head, head + 1U, memory_order_release);
 }
 
-static double parse_utc_to_seconds(const char *utc_str) 
+static void format_status(const struct gnssdata_snapshot *sample, char *buf, size_t size)
 {
-    int hh = 0, mm = 0;
-    double ss = 0.0;
+    char sats[8] = "NA";
+    char ant[8] = "NA";
 
-    /* Parse string in format "hhmmss.ss" */
-    if (sscanf(utc_str, "%2d%2d%lf", &hh, &mm, &ss) != 3) {
-        return -1.0; // error
+    if (sample->sats_valid == TRUE)
+    {
+        (void)snprintf(sats, sizeof(sats), "%02d", sample->sats_in_view);
     }
 
-    /* Convert to total seconds since midnight */
-    return hh * 3600.0 + mm * 60.0 + ss;
+    if (sample->snr_valid == TRUE)
+    {
+        (void)snprintf(ant, sizeof(ant), "%02d", sample->snr_mean);
+    }
+
+    (void)snprintf(buf, size, "%s%s%s%s%s%s",
+        "Fix status: ",
+        ((sample->fix_valid == TRUE) ? "OK" : "NA"),
+        ", Sattelites in view: ",
+        sats,
+        ", Signal strength: ",
+        ant);
 }
@@ -4,16 +4,66 @@
 #include "typedefs.h"
 
 
+/* Most satellites gnssdata_get_sky() reports, all talkers together */
+#define GNSSDATA_SATELLITES_MAX     (64U)
+/* Satellites at or above this SNR count as strong (dBHz) */
+#define GNSSDATA_SNR_STRONG         (30)
+
+/*
+ * Everything known about an epoch. The latest one is read in one piece with
+ * gnssdata_get_snapshot(), each of them in order with gnssdata_pop_sample()
+ */
+struct gnssdata_snapshot
+{
+    U32 epoch;          /* Incremented for every RMC sentence */
+    S32 utc_ms;         /* UTC milliseconds since midnight, -1 if unknown */
+    S32 speed_mmps;     /* Speed over ground in millimetres per second, -1 if unknown */
+    S64 arrival_ns;     /* CLOCK_MONOTONIC arrival of the RMC sentence in the line discipline */
+    Boolean fix_valid;
+    Boolean sats_valid;
+    int sats_in_view;   /* All talkers */
+    Boolean sats_used_valid;
+    int sats_used;      /* From GGA while there is a fix */
+    Boolean snr_valid;  /* SNR aggregates over the tracked satellites of the last complete GSV sets */
+    int snr_mean;
+    int snr_min;
+    int snr_max;
+    int sats_tracked;   /* Satellites that report an SNR */
+    int sats_strong;    /* ... of at least GNSSDATA_SNR_STRONG */
+};
+
+/* One satellite of a GSV set */
+struct gnssdata_satellite
+{
+    char talker[2];     /* "GP", "GL", "GA"... */
+    U8 signal;          /* NMEA 4.10 signal ID, 0 when not sent */
+    U8 snr;             /* dBHz, 0 when not tracked */
+    U16 prn;
+    S16 elevation;      /* Degrees, -1 if unknown */
+    S16 azimuth;        /* Degrees, -1 if unknown */
+};
+
+/* Satellites in view, each talker as of its last complete GSV set */
+struct gnssdata_sky
+{
+    U32 epoch;          /* Epoch the last set completed in */
+    unsigned int count;
+    struct gnssdata_satellite sats[GNSSDATA_SATELLITES_MAX];
+};
+
+
 extern void gnssdata_start(void);
 extern void gnssdata_stop(void);
+extern void gnssdata_subscribe(void);
+extern void gnssdata_unsubscribe(void);
 extern Boolean gnssdata_poll_status(void);
 extern void gnssdata_get_status(char **buf);
-extern double gnssdata_get_timestamp(void);
-extern double gnssdata_get_speed(void);
-
-
-extern Boolean gnssdata_get_status_flag;
-
+extern void gnssdata_get_snapshot(struct gnssdata_snapshot *snapshot);
+extern void gnssdata_get_sky(struct gnssdata_sky *sky);
+extern int gnssdata_get_epoch_fd(void);
+extern Boolean gnssdata_pop_sample(struct gnssdata_snapshot *sample);
+extern void gnssdata_flush_samples(void);
+extern U32 gnssdata_get_dropped_samples(void);
 
 
 #endif /* GNSSDATA_H */
@@ -0,0 +1,672 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/tty.h>   // for TIOCSETD
+
+#include "typedefs.h"
+#include "aesdlog.h"
+#include "gnssinput.h"
+#include "gnssreceiver.h"
+
+
+/* ---------------------------------------------  */
+/* Private macro declarations */
+/* ---------------------------------------------  */
+
+
+#define SPEC_MAX_LEN                (160U)
+/* Longest sentence we take, including NUL. Same as the line discipline */
+#define NMEA_MAX_LEN                (128U)
+/* Big enough to take a whole epoch of sentences in one read() */
+#define INPUT_BUF_SIZE              (1024U)
+/* aesd-gnssposget-driver TTY Line Discipline number */
+#define N_GNSSPOSGET                (20)
+
+#define UART_BAUD_DEFAULT           (9600)
+#define REPLAY_SPEED_DEFAULT        (1)
+#define MS_PER_DAY                  (86400000LL)
+
+
+/* ---------------------------------------------  */
+/* Private types declarations */
+/* ---------------------------------------------  */
+
+
+struct gnssinput_backend
+{
+    const char *name;                   /* Spec prefix */
+    Boolean needs_path;
+    Boolean recording;                  /* Ends by itself, see gnssinput_is_recording() */
+    int  (*open)(void);                 /* File descriptor to read, -1 on error */
+    int  (*read)(void);                 /* 1 keep going, 0 recording ended, -1 error */
+    int  (*poll_fd)(int *timeout_ms);   /* NULL: poll the open() descriptor without timeout */
+};
+
+
+/* ---------------------------------------------  */
+/* static functions declarations */
+/* ---------------------------------------------  */
+
+
+static int ldisc_open(void);
+static int ldisc_read(void);
+static int uart_open(void);
+static int pty_open(void);
+static int stdin_open(void);
+static int raw_read(void);
+static int file_open(void);
+static int file_read(void);
+static int file_poll_fd(int *timeout_ms);
+static int tty_open_raw(speed_t speed);
+static Boolean raw_feed(char c, S64 now);
+static Boolean replay_utc_ms(const char *sentence, S64 *out);
+static S64 monotonic_ns(void);
+
+
+/* ---------------------------------------------  */
+/* static variables declarations */
+/* ---------------------------------------------  */
+
+
+static const struct gnssinput_backend backends[] =
+{
+    { "ldisc", TRUE,  FALSE, ldisc_open, ldisc_read, NULL },
+    { "uart",  TRUE,  FALSE, uart_open,  raw_read,   NULL },
+    { "pty",   TRUE,  FALSE, pty_open,   raw_read,   NULL },
+    { "file",  TRUE,  TRUE,  file_open,  file_read,  file_poll_fd },
+    { "stdin", FALSE, TRUE,  stdin_open, raw_read,   NULL }
+};
+
+#define BACKENDS_NUM                (sizeof(backends) / sizeof(backends[0]))
+
+static const struct gnssinput_backend *backend = &backends[0];
+static char spec_str[SPEC_MAX_LEN] = GNSSINPUT_DEFAULT;
+static char path[SPEC_MAX_LEN] = "/dev/ttyAMA1";
+static long param;
+static Boolean param_set = FALSE;
+
+static int fd = -1;
+static gnssinput_handler handler;
+static const struct gnssposget_filter *filter;
+
+/* Bytes read but not handled yet */
+static char buf[INPUT_BUF_SIZE];
+static int buf_len;
+static int buf_pos;
+
+/* Sentence being assembled by raw_feed() */
+static char line[NMEA_MAX_LEN];
+static unsigned int line_len;
+static Boolean in_line;
+static S64 line_stamp;
+
+/* File replay: line holds an RMC due at replay_due_ns */
+static Boolean replay_held;
+static S64 replay_due_ns;
+static S64 replay_start_ns;
+static S64 replay_first_ms;
+static long replay_speed;
+
+
+/* ---------------------------------------------  */
+/* Public functions */
+/* ---------------------------------------------  */
+
+
+/* Picks the input for the following gnssinput_open() calls. FALSE if spec is not valid */
+Boolean gnssinput_select(const char *spec)
+{
+    unsigned int i;
+    size_t name_len = strcspn(spec, ":@");
+    const char *rest = &spec[name_len];
+    size_t path_len = 0U;
+    char *end;
+
+    if (strlen(spec) >= SPEC_MAX_LEN)
+    {
+        return FALSE;
+    }
+
+    for (i = 0U; i < BACKENDS_NUM; i++)
+    {
+        if ((strlen(backends[i].name) == name_len) && (strncmp(spec, backends[i].name, name_len) == 0))
+        {
+            break;
+        }
+    }
+
+    if (i == BACKENDS_NUM)
+    {
+        return FALSE;
+    }
+
+    if (*rest == ':')
+    {
+        rest++;
+        path_len = strcspn(rest, "@");
+    }
+
+    if ((backends[i].needs_path == TRUE) && (path_len == 0U))
+    {
+        return FALSE;
+    }
+
+    param_set = FALSE;
+    if (rest[path_len] == '@')
+    {
+        errno = 0;
+        param = strtol(&rest[path_len + 1U], &end, 10);
+        if ((errno != 0) || (*end != '\0') || (end == &rest[path_len + 1U]) || (param < 0))
+        {
+            return FALSE;
+        }
+
+        param_set = TRUE;
+    }
+    else if (rest[path_len] != '\0')
+    {
+        return FALSE;
+    }
+
+    backend = &backends[i];
+    (void)memcpy(path, rest, path_len);
+    path[path_len] = '\0';
+    (void)strcpy(spec_str, spec);
+    return TRUE;
+}
+
+const char *gnssinput_get_name(void)
+{
+    return spec_str;
+}
+
+/*
+ * TRUE for a recording: it ends by itself and is only worth reading while
+ * somebody listens. Opening a file again starts it over, stdin carries on
+ * where it was and stays ended once it did.
+ */
+Boolean gnssinput_is_recording(void)
+{
+    return backend->recording;
+}
+
+/*
+ * Opens the selected input. handler gets the sentences from gnssinput_read(),
+ * filter is applied where the input can drop sentences itself.
+ */
+Boolean gnssinput_open(gnssinput_handler sentence_handler, const struct gnssposget_filter *sentence_filter)
+{
+    handler = sentence_handler;
+    filter = sentence_filter;
+    buf_len = 0;
+    buf_pos = 0;
+    in_line = FALSE;
+    replay_held = FALSE;
+    replay_first_ms = -1;
+
+    aesdlog_dbg_info("gnssinput_open(): %s", spec_str);
+    fd = backend->open();
+    return (fd >= 0) ? TRUE : FALSE;
+}
+
+/* Descriptor to poll() for input and how long to wait at most. -1 for either: none */
+int gnssinput_poll_fd(int *timeout_ms)
+{
+    if (backend->poll_fd != NULL)
+    {
+        return backend->poll_fd(timeout_ms);
+    }
+
+    *timeout_ms = -1;
+    return fd;
+}
+
+/* Hands what is available to the handler. 1 keep going, 0 recording ended, -1 error */
+int gnssinput_read(void)
+{
+    return backend->read();
+}
+
+void gnssinput_close(void)
+{
+    if ((fd >= 0) && (fd != STDIN_FILENO))
+    {
+        close(fd);
+    }
+
+    fd = -1;
+}
+
+
+/* ---------------------------------------------  */
+/* Private functions */
+/* ---------------------------------------------  */
+
+
+/* UART brought up by gnssreceiver, sentences split and timestamped by n_gnssposget */
+static int ldisc_open(void)
+{
+    int tty_fd;
+    int ldisc = N_GNSSPOSGET;
+    __u32 mode = GNSSPOSGET_MODE_TEXT_TS;
+
+    aesdlog_dbg_info("Opening UART port %s", path);
+    tty_fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (tty_fd < 0) {
+        aesdlog_err("open: %s", strerror(errno));
+        return -1;
+    }
+
+    aesdlog_dbg_info("Attaching to TTY Line Discipline");
+    if (ioctl(tty_fd, TIOCSETD, &ldisc) < 0) {
+        aesdlog_err("ioctl(TIOCSETD): %s", strerror(errno));
+        close(tty_fd);
+        return -1;
+    }
+
+    /* Get each sentence with its kernel arrival time */
+    if (ioctl(tty_fd, GNSSPOSGET_IOCSMODE, &mode) < 0) {
+        aesdlog_err("ioctl(GNSSPOSGET_IOCSMODE): %s", strerror(errno));
+        close(tty_fd);
+        return -1;
+    }
+
+    if ((filter != NULL) && (ioctl(tty_fd, GNSSPOSGET_IOCSFILTER, filter) < 0)) {
+        aesdlog_err("ioctl(GNSSPOSGET_IOCSFILTER): %s", strerror(errno));
+        close(tty_fd);
+        return -1;
+    }
+
+    /* Baudrate, output messages and rate, done through the line discipline */
+    if (gnssreceiver_bring_up(tty_fd) == FALSE) {
+        aesdlog_err("Failed to set up GNSS module");
+        close(tty_fd);
+        return -1;
+    }
+
+    aesdlog_info("gnssinput: Attached line discipline %d to %s", ldisc, path);
+    return tty_fd;
+}
+
+static int ldisc_read(void)
+{
+    char *record, *sentence;
+    struct gnssposget_rec rec;
+    int ret = read(fd, &buf[buf_len], (sizeof(buf) - buf_len));
+
+    if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+    {
+        /* Nothing queued after all */
+        return 1;
+    }
+    else if (ret < 0)
+    {
+        aesdlog_err("UART read data error: %s", strerror(errno));
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        /* Hangup, the UART is gone until it is opened again */
+        aesdlog_err("gnssinput: %s hung up", path);
+        return -1;
+    }
+
+    /* One read may carry several records and the beginning of the next one */
+    buf_len += ret;
+    record = buf;
+    while (((buf + buf_len) - record) >= (int)sizeof(rec))
+    {
+        (void)memcpy(&rec, record, sizeof(rec));
+        if (rec.type == GNSSPOSGET_REC_UBX)
+        {
+            /* Binary frames aren't used yet, step over them */
+            if (((buf + buf_len) - record) < (int)(sizeof(rec) + rec.len))
+            {
+                break;
+            }
+            record += sizeof(rec) + rec.len;
+            continue;
+        }
+
+        if ((rec.type != GNSSPOSGET_REC_NMEA) || (rec.len == 0U) || (rec.len > NMEA_MAX_LEN))
+        {
+            aesdlog_err("gnssinput: unexpected record type %u len %u, dropping", rec.type, rec.len);
+            record = buf + buf_len;
+            break;
+        }
+
+        if (((buf + buf_len) - record) < (int)(sizeof(rec) + rec.len))
+        {
+            /* Rest of the sentence comes with the next read */
+            break;
+        }
+
+        /* Record is the sentence with its line end, then NUL: cut at the line end */
+        sentence = record + sizeof(rec);
+        sentence[rec.len - 1U] = '\0';
+        sentence[strcspn(sentence, "\r\n")] = '\0';
+        handler(sentence, (S64)rec.stamp_ns);
+        record = sentence + rec.len;
+    }
+
+    /* Keep unfinished record for the next read */
+    buf_len = (buf + buf_len) - record;
+    (void)memmove(buf, record, buf_len);
+    return 1;
+}
+
+/* UART without the line discipline, baudrate from the spec */
+static int uart_open(void)
+{
+    long baud = (param_set == TRUE) ? param : UART_BAUD_DEFAULT;
+    speed_t speed;
+
+    switch (baud)
+    {
+        case 4800:   speed = B4800;   break;
+        case 9600:   speed = B9600;   break;
+        case 19200:  speed = B19200;  break;
+        case 38400:  speed = B38400;  break;
+        case 57600:  speed = B57600;  break;
+        case 115200: speed = B115200; break;
+        case 230400: speed = B230400; break;
+        default:
+            aesdlog_err("gnssinput: unsupported baudrate %ld", baud);
+            return -1;
+    }
+
+    return tty_open_raw(speed);
+}
+
+/* Pseudo terminal, there is no baudrate to set */
+static int pty_open(void)
+{
+    return tty_open_raw(B0);
+}
+
+static int stdin_open(void)
+{
+    int flags = fcntl(STDIN_FILENO, F_GETFL);
+
+    if ((flags < 0) || (fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        aesdlog_err("fcntl(stdin): %s", strerror(errno));
+        return -1;
+    }
+
+    return STDIN_FILENO;
+}
+
+/* uart, pty and stdin: split the byte stream into sentences ourselves */
+static int raw_read(void)
+{
+    int i;
+    S64 now;
+    int ret = read(fd, buf, sizeof(buf));
+
+    if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+    {
+        return 1;
+    }
+    else if (ret < 0)
+    {
+        aesdlog_err("gnssinput: read error: %s", strerror(errno));
+        return -1;
+    }
+    else if (ret == 0)
+    {
+        if (backend->recording == FALSE)
+        {
+            /* Hangup of a tty or the pty's other end was closed, open it again */
+            aesdlog_err("gnssinput: %s hung up", path);
+            return -1;
+        }
+
+        aesdlog_info("gnssinput: end of input");
+        return 0;
+    }
+
+    now = monotonic_ns();
+    for (i = 0; i < ret; i++)
+    {
+        if (raw_feed(buf[i], now) == TRUE)
+        {
+            handler(line, line_stamp);
+        }
+    }
+
+    return 1;
+}
+
+static int file_open(void)
+{
+    int file_fd = open(path, O_RDONLY);
+
+    if (file_fd < 0)
+    {
+        aesdlog_err("open(%s): %s", path, strerror(errno));
+        return -1;
+    }
+
+    replay_speed = (param_set == TRUE) ? param : REPLAY_SPEED_DEFAULT;
+    aesdlog_info("gnssinput: Replaying %s at %ldx", path, replay_speed);
+    return file_fd;
+}
+
+/*
+ * Recording: hands sentences out as the RMC times in it say, divided by
+ * replay_speed. An RMC that isn't due yet waits in line, file_poll_fd()
+ * tells how long. Arrival times are when a sentence is handed out.
+ */
+static int file_read(void)
+{
+    S64 now = monotonic_ns();
+    S64 utc_ms, elapsed_ms;
+
+    if (replay_held == TRUE)
+    {
+        if (now < replay_due_ns)
+        {
+            return 1;
+        }
+
+        replay_held = FALSE;
+        handler(line, now);
+    }
+
+    if (buf_pos == buf_len)
+    {
+        int ret = read(fd, buf, sizeof(buf));
+        if ((ret < 0) && (errno == EINTR))
+        {
+            return 1;
+        }
+        else if (ret < 0)
+        {
+            aesdlog_err("gnssinput: read error: %s", strerror(errno));
+            return -1;
+        }
+        else if (ret == 0)
+        {
+            aesdlog_info("gnssinput: end of %s", path);
+            return 0;
+        }
+
+        buf_len = ret;
+        buf_pos = 0;
+    }
+
+    while (buf_pos < buf_len)
+    {
+        if (raw_feed(buf[buf_pos++], now) == FALSE)
+        {
+            continue;
+        }
+
+        if ((replay_speed > 0) && (replay_utc_ms(line, &utc_ms) == TRUE))
+        {
+            if (replay_first_ms < 0)
+            {
+                replay_first_ms = utc_ms;
+                replay_start_ns = now;
+            }
+
+            elapsed_ms = utc_ms - replay_first_ms;
+            if (elapsed_ms < 0)
+            {
+                /* Recording goes over midnight */
+                elapsed_ms += MS_PER_DAY;
+            }
+
+            replay_due_ns = replay_start_ns + ((elapsed_ms * 1000000LL) / replay_speed);
+            if (replay_due_ns > now)
+            {
+                replay_held = TRUE;
+                return 1;
+            }
+        }
+
+        handler(line, now);
+    }
+
+    return 1;
+}
+
+/* Nothing to poll on a file, only a timeout until the held RMC is due */
+static int file_poll_fd(int *timeout_ms)
+{
+    S64 wait_ns = 0;
+
+    if (replay_held == TRUE)
+    {
+        wait_ns = replay_due_ns - monotonic_ns();
+    }
+
+    *timeout_ms = (wait_ns > 0) ? (int)((wait_ns + 999999LL) / 1000000LL) : 0;
+    return -1;
+}
+
+/* Opens path as raw tty, speed B0 keeps the current one */
+static int tty_open_raw(speed_t speed)
+{
+    struct termios tio;
+    int tty_fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+
+    if (tty_fd < 0)
+    {
+        aesdlog_err("open(%s): %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (tcgetattr(tty_fd, &tio) < 0)
+    {
+        aesdlog_err("tcgetattr(%s): %s", path, strerror(errno));
+        close(tty_fd);
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (speed != B0)
+    {
+        (void)cfsetispeed(&tio, speed);
+        (void)cfsetospeed(&tio, speed);
+    }
+
+    if (tcsetattr(tty_fd, TCSANOW, &tio) < 0)
+    {
+        aesdlog_err("tcsetattr(%s): %s", path, strerror(errno));
+        close(tty_fd);
+        return -1;
+    }
+
+    aesdlog_info("gnssinput: Reading %s raw", path);
+    return tty_fd;
+}
+
+/*
+ * Adds one byte to line. Anything outside '$' ... CR/LF, e.g. UBX frames,
+ * is skipped, too long sentences are dropped. TRUE when line holds a
+ * complete sentence.
+ */
+static Boolean raw_feed(char c, S64 now)
+{
+    if (c == '$')
+    {
+        in_line = TRUE;
+        line_len = 0U;
+        line_stamp = now;
+    }
+
+    if (in_line == FALSE)
+    {
+        return FALSE;
+    }
+
+    if ((c == '\r') || (c == '\n'))
+    {
+        in_line = FALSE;
+        line[line_len] = '\0';
+        return TRUE;
+    }
+
+    if (line_len >= (NMEA_MAX_LEN - 1U))
+    {
+        in_line = FALSE;
+        return FALSE;
+    }
+
+    line[line_len++] = c;
+    return FALSE;
+}
+
+/* UTC time of an RMC sentence in milliseconds, "$xxRMC,hhmmss.sss" */
+static Boolean replay_utc_ms(const char *sentence, S64 *out)
+{
+    const char *time_field = &sentence[7];
+    S64 ms = 0;
+    S64 scale = 100;
+    int i;
+
+    if ((strncmp(&sentence[3], "RMC,", 4U) != 0) || (strlen(time_field) < 6U))
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < 6; i++)
+    {
+        if ((time_field[i] < '0') || (time_field[i] > '9'))
+        {
+            return FALSE;
+        }
+    }
+
+    ms = ((((time_field[0] - '0') * 10) + (time_field[1] - '0')) * 3600000LL) +
+         ((((time_field[2] - '0') * 10) + (time_field[3] - '0')) * 60000LL) +
+         ((((time_field[4] - '0') * 10) + (time_field[5] - '0')) * 1000LL);
+    if (time_field[6] == '.')
+    {
+        for (i = 7; (scale > 0) && (time_field[i] >= '0') && (time_field[i] <= '9'); i++)
+        {
+            ms += (time_field[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    *out = ms;
+    return TRUE;
+}
+
+static S64 monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((S64)now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
@@ -0,0 +1,32 @@
+#ifndef GNSSINPUT_H
+#define GNSSINPUT_H
+
+#include "typedefs.h"
+#include "../aesd-gnssposget-driver/gnssposget_ioctl.h"
+
+
+/*
+ * Where NMEA sentences come from, chosen once at startup with
+ * "<backend>[:<path>][@<param>]":
+ *
+ *   ldisc:/dev/ttyAMA1     UART brought up by gnssreceiver, read through n_gnssposget (default)
+ *   uart:/dev/ttyUSB0@9600 UART read raw at the given baudrate
+ *   pty:/tmp/gnss-out      pseudo terminal, e.g. one end of a socat pair
+ *   file:drive.nmea@10     recording replayed at 10x its RMC times, @0 as fast as possible
+ *   stdin
+ */
+#define GNSSINPUT_DEFAULT           ("ldisc:/dev/ttyAMA1")
+
+/* Gets every complete sentence, NUL terminated without CR LF */
+typedef void (*gnssinput_handler)(const char *sentence, S64 arrival_ns);
+
+extern Boolean gnssinput_select(const char *spec);
+extern const char *gnssinput_get_name(void);
+extern Boolean gnssinput_is_recording(void);
+extern Boolean gnssinput_open(gnssinput_handler handler, const struct gnssposget_filter *filter);
+extern int  gnssinput_poll_fd(int *timeout_ms);
+extern int  gnssinput_read(void);
+extern void gnssinput_close(void);
+
+
+#endif /* GNSSINPUT_H */
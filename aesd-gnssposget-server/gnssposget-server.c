@@ -1,7 +1,10 @@
 #include <sys/socket.h> /* sockaddr_in */
 #include <netdb.h> /* gethints() */
 #include <sys/types.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <pthread.h>
+#include <errno.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -25,7 +28,6 @@
 #define NUM_THREADS                 (128)
 #define CLIENT_RECEIVE_TIMEOUT      (2U)
 
-#define SLEEP_WAIT_TIMEOUT_S        (3U)
 #define POLL_STATUS_TIMEOUT_S       (15U)
 #define ACCEL_TIMEOUT_S             (30U)
 
@@ -81,6 +83,8 @@ task_params t_params;
 pthread_mutex_t state_mutex;
 
 Boolean teardown_requested;
+/* Wakes server_run out of wait_for_event() on state changes and teardown */
+static int state_event_fd = -1;
 Boolean status_requested = FALSE;
 
 
@@ -96,6 +100,7 @@ static Boolean send_to_client(struct state_machine_params* sm_params, char *buf)
 static serverapp_states get_state(serverapp_states *state_var);
 static void send_status_data_to_client(struct state_machine_params* sm_params, char *additional_info);
 static void set_state(serverapp_states *state_var, serverapp_states new_state);
+static void wait_for_event(int timeout_s);
 static void teardown(void);
 
 /* ---------------------------------------------  */
@@ -109,6 +114,15 @@ void gnssposget_server_mainloop(int *listen_fd)
     
     pthread_mutex_init(&state_mutex, NULL);
 
+    /* Receiver is read from now on, sessions only subscribe to it */
+    gnssdata_start();
+
+    state_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (state_event_fd < 0)
+    {
+        aesdlog_err("eventfd: %s", strerror(errno));
+    }
+
     /* Accept incoming connection */
     conf_fd = socket_connections_accept_incoming(&client_addr, listen_fd);
     aesdlog_info("Connected to client");
@@ -123,12 +137,22 @@ void gnssposget_server_mainloop(int *listen_fd)
     }
 
     teardown();
+    if (state_event_fd >= 0)
+    {
+        close(state_event_fd);
+        state_event_fd = -1;
+    }
+
     aesdlog_info("gnssposget - leaving main loop");
 }
 
 void gnssposget_server_request_teardown(void)
 {
     teardown_requested = TRUE;
+    if (state_event_fd >= 0)
+    {
+        (void)eventfd_write(state_event_fd, 1);
+    }
 }
 
 
@@ -212,11 +236,12 @@ static void server_run(task_params* arguments)
             case STATE_WAITING_FOR_CLIENT:
             {
                 /* Listener is running. Just wait for a next state */
+                wait_for_event(-1);
                 break;
             }
             case STATE_START_REQUESTED:
             {
-                gnssdata_start();
+                gnssdata_subscribe();
                 timer_start();
                 set_state(&sm_params.current_state, STATE_START_REQUESTED_POLL_SIGNAL);
                 break;
@@ -229,16 +254,11 @@ static void server_run(task_params* arguments)
                     aesdlog_dbg_info("STATE_START_REQUESTED_POLL_SIGNAL: Fix obtained");
                     char sendstr[100];
                     char *status_string;
-                    gnssdata_get_status_flag = FALSE;
                     timer_stop();
                     gnssdata_get_status(&status_string);
                     sprintf(sendstr, "STATE_START_REQUESTED^WORKING^%s\n", status_string);
                     free(status_string);
 
-                    /* Read timestamp and speed once to skip possible old data */
-                    (void)gnssdata_get_speed();
-                    (void)gnssdata_get_timestamp();
-
                     /* Ready to capture GNSS data */
                     set_state(&sm_params.current_state, STATE_WORKING);
                     (void)send_to_client(&sm_params, sendstr);
@@ -251,9 +271,8 @@ static void server_run(task_params* arguments)
                         /* Timeout occurred. Send info to client */
                         aesdlog_err("STATE_START_REQUESTED_POLL_SIGNAL: No fix obtained");
                         char sendstr[100];
-                        gnssdata_get_status_flag = FALSE;
                         timer_stop();
-                        gnssdata_stop();
+                        gnssdata_unsubscribe();
                         sprintf(sendstr, "STATE_START_REQUESTED^NO_SIGNAL^%d\n", (int)POLL_STATUS_TIMEOUT_S);
                         (void)send_to_client(&sm_params, sendstr);
                         set_state(&sm_params.current_state, STATE_DONE);
@@ -261,13 +280,15 @@ static void server_run(task_params* arguments)
                     else
                     {
                         aesdlog_dbg_info("Waiting for fix...");
-                        sleep(SLEEP_WAIT_TIMEOUT_S);
+                        wait_for_event(POLL_STATUS_TIMEOUT_S);
                     }
                 }
             }
             break;
             case STATE_WORKING:
             {
+                /* Measure from the epochs that come after the fix was reported */
+                gnssdata_flush_samples();
                 timer_start();
                 accelmeter_app_start();
                 set_state(&sm_params.current_state, STATE_WORKING_WAIT_ACCEL);
@@ -278,18 +299,33 @@ static void server_run(task_params* arguments)
             /* **************** */
             case STATE_WORKING_WAIT_ACCEL:
             {
-                /* Get speed & timestamp data and validate it */
-                double timestamp, speed;
+                /* Get speed & timestamp of the same epoch and validate them */
+                struct gnssdata_snapshot sample;
+                S32 utc_ms, speed_mmps;
                 Boolean add_result = FALSE;
-                if (((speed = gnssdata_get_speed()) != -1.0) &&
-                    ((timestamp = gnssdata_get_timestamp()) != -1.0))
+                if (gnssdata_pop_sample(&sample) == FALSE)
+                {
+                    if (timer_is_elapsed(ACCEL_TIMEOUT_S) == FALSE)
+                    {
+                        /* Nothing new. Sleep until the next epoch, a client command or the timeout */
+                        wait_for_event(ACCEL_TIMEOUT_S);
+                        break;
+                    }
+
+                    /* Timed out. The last epoch was handled already, it only gets us to the timeout checks */
+                    gnssdata_get_snapshot(&sample);
+                }
+
+                speed_mmps = sample.speed_mmps;
+                utc_ms = sample.utc_ms;
+                if ((speed_mmps >= 0) && (utc_ms >= 0))
                 {
                     /* Only do checks if received new timestamp */
-                    add_result = accelmeter_app_add_data(timestamp, speed);
-                    if ((speed >= (double)ACCELMETER_APP_START_SPEED_THRESHOLD) && (add_result == TRUE))
+                    add_result = accelmeter_app_add_data(utc_ms, speed_mmps);
+                    if ((ACCELMETER_APP_SPEED_REACHED(speed_mmps, ACCELMETER_APP_START_SPEED_THRESHOLD)) && (add_result == TRUE))
                     {
                         /* Acceleration started. Restart timer */
-                        aesdlog_dbg_info("STATE_WORKING_WAIT_ACCEL: Acceleration started at timestamp %.2f", timestamp);
+                        aesdlog_dbg_info("STATE_WORKING_WAIT_ACCEL: Acceleration started at UTC %ld ms", (long)utc_ms);
                         timer_stop();
                         timer_start();
                         set_state(&sm_params.current_state, STATE_WORKING_MEASURE);
@@ -304,7 +340,7 @@ static void server_run(task_params* arguments)
                             aesdlog_err("STATE_WORKING_WAIT_ACCEL: No acceleration detected");
                             timer_stop();
                             accelmeter_app_stop();
-                            gnssdata_stop();
+                            gnssdata_unsubscribe();
                             sprintf(sendstr, "STATE_WORKING^RUNNING_TIMEOUT^0#%d\n", (int)ACCEL_TIMEOUT_S);
                             (void)send_to_client(&sm_params, sendstr);
                             set_state(&sm_params.current_state, STATE_DONE);
@@ -329,13 +365,11 @@ static void server_run(task_params* arguments)
                         aesdlog_err("STATE_WORKING_WAIT_ACCEL: Invalid data received");
                         accelmeter_app_stop();
                         timer_stop();
-                        gnssdata_stop();
+                        gnssdata_unsubscribe();
                         send_status_data_to_client(&sm_params, "RUNNING_ERROR^");
                         set_state(&sm_params.current_state, STATE_DONE);
                     }
                 }
-
-                usleep(200);
             }
             break;
             /* **************** */
@@ -343,27 +377,43 @@ static void server_run(task_params* arguments)
             /* **************** */
             case STATE_WORKING_MEASURE:
             {
-                /* Get speed & timestamp data and validate it */
-                double timestamp, speed, checkpoint;
+                /* Get speed & timestamp of the same epoch and validate them */
+                struct gnssdata_snapshot sample;
+                S32 utc_ms, speed_mmps;
+                int checkpoint;
                 Boolean add_result = FALSE;
-                if (((speed = gnssdata_get_speed()) != -1.0) &&
-                    ((timestamp = gnssdata_get_timestamp()) != -1.0))
+                if (gnssdata_pop_sample(&sample) == FALSE)
+                {
+                    if (timer_is_elapsed(ACCEL_TIMEOUT_S) == FALSE)
+                    {
+                        /* Nothing new. Sleep until the next epoch, a client command or the timeout */
+                        wait_for_event(ACCEL_TIMEOUT_S);
+                        break;
+                    }
+
+                    /* Timed out. The last epoch was handled already, it only gets us to the timeout checks */
+                    gnssdata_get_snapshot(&sample);
+                }
+
+                speed_mmps = sample.speed_mmps;
+                utc_ms = sample.utc_ms;
+                if ((speed_mmps >= 0) && (utc_ms >= 0))
                 {
                     /* Only do checks if received new timestamp */
-                    add_result = accelmeter_app_add_data(timestamp, speed);
+                    add_result = accelmeter_app_add_data(utc_ms, speed_mmps);
                     checkpoint = accelmeter_app_get_current_checkpoint();
-                    if ((checkpoint == 0.0) && (add_result == TRUE))
+                    if ((checkpoint == 0) && (add_result == TRUE))
                     {
                         /* Reached final checkpoint */
                         aesdlog_dbg_info("STATE_WORKING_MEASURE: Final checkpoint reached");
                         timer_stop();
-                        gnssdata_stop();
+                        gnssdata_unsubscribe();
                         set_state(&sm_params.current_state, STATE_WORKING_ANALYZE);
                     }
-                    else if ((speed >= (double)checkpoint) && (add_result == TRUE))
+                    else if ((ACCELMETER_APP_SPEED_REACHED(speed_mmps, checkpoint)) && (add_result == TRUE))
                     {
                         /* Passed checkpoint */
-                        aesdlog_dbg_info("STATE_WORKING_MEASURE: Passed checkpoint %d at timestamp %.3lf", (int)checkpoint, timestamp);
+                        aesdlog_dbg_info("STATE_WORKING_MEASURE: Passed checkpoint %d at UTC %ld ms", checkpoint, (long)utc_ms);
                         accelmeter_app_set_checkpoint(checkpoint);
                         timer_stop();
                         timer_start();
@@ -374,7 +424,7 @@ static void server_run(task_params* arguments)
                         if (timer_is_elapsed(ACCEL_TIMEOUT_S) == TRUE)
                         {
                             timer_stop();
-                            gnssdata_stop();
+                            gnssdata_unsubscribe();
                             set_state(&sm_params.current_state, STATE_WORKING_ANALYZE);
                         }
                         else
@@ -391,8 +441,8 @@ static void server_run(task_params* arguments)
                     {
                         aesdlog_err("STATE_WORKING_MEASURE: Invalid data received %d times", (int)ACCELMETER_APP_MAX_INCORRECT_DATA_INSTANCES);
                         timer_stop();
-                        gnssdata_stop();
-                        if (accelmeter_app_get_current_checkpoint() > 0.0)
+                        gnssdata_unsubscribe();
+                        if (accelmeter_app_get_current_checkpoint() > 0)
                         {
                             /* We got some data */
                             aesdlog_dbg_info("STATE_WORKING_MEASURE: Some valid data received");
@@ -408,31 +458,37 @@ static void server_run(task_params* arguments)
                         }
                     }
                 }
-
-                usleep(100);
             }
             break;
             case STATE_WORKING_ANALYZE:
             {
-                double accel_time[] = {-1.0, -1.0, -1.0};
+                S32 accel_time_ms[] = {-1, -1, -1};
                 int i;
                 aesdlog_dbg_info("STATE_WORKING_ANALYZE: Analyzing data");
+                if (gnssdata_get_dropped_samples() != 0U)
+                {
+                    aesdlog_err("STATE_WORKING_ANALYZE: %u epochs were dropped, timing may be off",
+                                (unsigned int)gnssdata_get_dropped_samples());
+                }
+
                 accelmeter_app_accel_to_file(); /* Only if debug enabled */
-                accelmeter_app_analyze_data(&accel_time[0], &accel_time[1], &accel_time[2]);
+                accelmeter_app_analyze_data(&accel_time_ms[0], &accel_time_ms[1], &accel_time_ms[2]);
                 accelmeter_app_stop();
 
                 for (i = 0; i < 3; i++)
                 {
                     char sendstr[100];
-                    if (accel_time[i] < 0.0)
+                    if (accel_time_ms[i] < 0)
                     {
                         aesdlog_dbg_info("STATE_WORKING_ANALYZE: Checkpoint %d not reached", i);
                         snprintf(sendstr, sizeof(sendstr), "STATE_WORKING^RUNNING_TIMEOUT^%d#%d\n", i, (int)(ACCEL_TIMEOUT_S));
                     }
                     else
                     {
-                        aesdlog_dbg_info("STATE_WORKING_ANALYZE: Checkpoint %d reached at time %.3lf", i, accel_time[i]);
-                        snprintf(sendstr, sizeof(sendstr), "STATE_WORKING^RUNNING_STATUS^%d#%.2lf\n", i, accel_time[i]);
+                        aesdlog_dbg_info("STATE_WORKING_ANALYZE: Checkpoint %d reached after %ld ms", i, (long)accel_time_ms[i]);
+                        /* Seconds with two decimals, rounded */
+                        snprintf(sendstr, sizeof(sendstr), "STATE_WORKING^RUNNING_STATUS^%d#%ld.%02ld\n", i,
+                                 (long)((accel_time_ms[i] + 5) / 1000), (long)(((accel_time_ms[i] + 5) % 1000) / 10));
                     }
 
                     (void)send_to_client(&sm_params, sendstr);
@@ -447,7 +503,7 @@ static void server_run(task_params* arguments)
                 /* Handle abort requested */
                 sm_params.run_listener = FALSE;
                 timer_stop();
-                gnssdata_stop();
+                gnssdata_unsubscribe();
                 accelmeter_app_stop();
                 set_state(&sm_params.current_state, STATE_DONE);
                 (void)send_to_client(&sm_params, (char *)"ABORTED\n");
@@ -563,7 +619,7 @@ static void listener_task(void* arg)
 static void read_client_error(serverapp_states* current_state)
 {
     aesdlog_err("Failed to read data from client");
-    *current_state = STATE_UNEXPECTED_ERROR;
+    set_state(current_state, STATE_UNEXPECTED_ERROR);
 }
 
 static void set_state(serverapp_states *state_var, serverapp_states new_state)
@@ -571,6 +627,42 @@ static void set_state(serverapp_states *state_var, serverapp_states new_state)
     pthread_mutex_lock(&state_mutex);
     *state_var = new_state;
     pthread_mutex_unlock(&state_mutex);
+
+    /* server_run may be sleeping in wait_for_event() */
+    if (state_event_fd >= 0)
+    {
+        (void)eventfd_write(state_event_fd, 1);
+    }
+}
+
+/*
+ * Sleeps until gnssdata publishes a new epoch, the state is changed or
+ * timeout_s seconds since timer_start() pass. Without a running timer
+ * only the first two wake it up.
+ */
+static void wait_for_event(int timeout_s)
+{
+    struct pollfd fds[2];
+    eventfd_t count;
+    int timeout_ms = (timeout_s < 0) ? -1 : timer_remaining_ms(timeout_s);
+
+    fds[0].fd = gnssdata_get_epoch_fd();   /* Negative, thus ignored, while gnssdata is stopped */
+    fds[0].events = POLLIN;
+    fds[1].fd = state_event_fd;
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, timeout_ms) > 0)
+    {
+        if (fds[0].revents & POLLIN)
+        {
+            (void)eventfd_read(fds[0].fd, &count);
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            (void)eventfd_read(fds[1].fd, &count);
+        }
+    }
 }
 
 static serverapp_states get_state(serverapp_states *state_var)
@@ -603,9 +695,8 @@ static void send_status_data_to_client(struct state_machine_params* sm_params, c
 {
     char *status_string;
     char sendstr[100];
-    gnssdata_get_status_flag = TRUE;
-    sleep(1);
-    gnssdata_get_status_flag = FALSE;
+
+    /* Status is kept by the reader all the time, just render the latest epoch */
     gnssdata_get_status(&status_string);
     sprintf(sendstr, "STATE_WORKING^%s%s\n", additional_info, status_string);
     free(status_string);
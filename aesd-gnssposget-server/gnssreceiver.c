@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+
+#include "../aesd-gnssposget-driver/gnssposget_ioctl.h"
+#include "typedefs.h"
+#include "aesdlog.h"
+#include "gnssreceiver.h"
+
+
+/* ---------------------------------------------  */
+/* Private macro declarations */
+/* ---------------------------------------------  */
+
+
+/* Receiver sends at least once a second, give it a little more */
+#define SENTENCE_TIMEOUT_MS         (1100)
+/* Enough for the records of one epoch */
+#define RECORD_BUF_SIZE             (1024U)
+
+#define UBX_SYNC_1                  (0xB5U)
+#define UBX_SYNC_2                  (0x62U)
+#define UBX_HEADER_LEN              (6U)
+#define UBX_FRAME_MAX               (UBX_HEADER_LEN + 20U + 2U)
+#define UBX_CLASS_CFG               (0x06U)
+#define UBX_CFG_PRT                 (0x00U)
+#define UBX_CFG_MSG                 (0x01U)
+#define UBX_CFG_RATE                (0x08U)
+/* NMEA standard messages class */
+#define UBX_CLASS_NMEA              (0xF0U)
+#define UBX_NMEA_GGA                (0x00U)
+#define UBX_NMEA_GLL                (0x01U)
+#define UBX_NMEA_GSA                (0x02U)
+#define UBX_NMEA_VTG                (0x05U)
+/* A CFG message the receiver didn't acknowledge is sent once more */
+#define UBX_CFG_TRIES               (2)
+
+
+/* ---------------------------------------------  */
+/* static functions declarations */
+/* ---------------------------------------------  */
+
+
+static Boolean set_baud(int fd, int baud);
+static Boolean wait_sentence(int fd, int timeout_ms);
+static Boolean nmea_checksum_ok(const char *sentence);
+static Boolean ubx_send(int fd, U8 cls, U8 id, const U8 *payload, U16 len, Boolean wait_ack);
+static Boolean ubx_configure(int fd, U8 id, const U8 *payload, U16 len, const char *what);
+static S64 monotonic_ms(void);
+
+
+/* ---------------------------------------------  */
+/* static variables declarations */
+/* ---------------------------------------------  */
+
+
+/* Most likely first: already brought up, then the receiver's default */
+static const int detect_bauds[] = { GNSSRECEIVER_BAUD, 9600, 38400, 57600, 115200, 4800 };
+
+/*
+ * NMEA output we don't need, RMC and GSV keep going. At GNSSRECEIVER_BAUD
+ * an epoch every GNSSRECEIVER_RATE_MS carries 384 bytes, RMC and three GSV
+ * already take most of it. RMC has the speed, so VTG isn't needed, and
+ * nobody uses the satellites GGA counts.
+ */
+static const U8 disabled_nmea[] = { UBX_NMEA_GSA, UBX_NMEA_GGA, UBX_NMEA_VTG, UBX_NMEA_GLL };
+
+
+/* ---------------------------------------------  */
+/* Public functions */
+/* ---------------------------------------------  */
+
+
+/*
+ * Finds the receiver's baudrate and configures it. fd is the UART with
+ * n_gnssposget attached in GNSSPOSGET_MODE_TEXT_TS, readable and writable.
+ * Returns TRUE once a valid sentence arrived at GNSSRECEIVER_BAUD.
+ * Sentences read on the way are dropped.
+ */
+Boolean gnssreceiver_bring_up(int fd)
+{
+    S64 start = monotonic_ms();
+    unsigned int i;
+    int baud = 0;
+    U8 msg[3];
+    U8 rate[6];
+    U8 prt[20];
+
+    for (i = 0U; i < (sizeof(detect_bauds) / sizeof(detect_bauds[0])); i++)
+    {
+        if ((set_baud(fd, detect_bauds[i]) == TRUE) && (wait_sentence(fd, SENTENCE_TIMEOUT_MS) == TRUE))
+        {
+            baud = detect_bauds[i];
+            break;
+        }
+    }
+
+    if (baud == 0)
+    {
+        aesdlog_err("gnssreceiver: no valid sentence at any baudrate");
+        return FALSE;
+    }
+
+    aesdlog_info("gnssreceiver: receiver talks at %d baud", baud);
+    if (baud == GNSSRECEIVER_BAUD)
+    {
+        /* Port settings are sent last, so the rest was done before too */
+        aesdlog_info("gnssreceiver: ready after %lld ms", monotonic_ms() - start);
+        return TRUE;
+    }
+
+    for (i = 0U; i < sizeof(disabled_nmea); i++)
+    {
+        /* Class, ID, rate 0 on the current port */
+        msg[0] = UBX_CLASS_NMEA;
+        msg[1] = disabled_nmea[i];
+        msg[2] = 0U;
+        if (ubx_configure(fd, UBX_CFG_MSG, msg, sizeof(msg), "CFG-MSG") == FALSE)
+        {
+            return FALSE;
+        }
+    }
+
+    /* measRate, navRate 1, timeRef GPS */
+    rate[0] = (U8)(GNSSRECEIVER_RATE_MS & 0xFFU);
+    rate[1] = (U8)(GNSSRECEIVER_RATE_MS >> 8);
+    rate[2] = 1U;
+    rate[3] = 0U;
+    rate[4] = 1U;
+    rate[5] = 0U;
+    if (ubx_configure(fd, UBX_CFG_RATE, rate, sizeof(rate), "CFG-RATE") == FALSE)
+    {
+        return FALSE;
+    }
+
+    /* UART1, 8N1, UBX+NMEA in, UBX+NMEA out at GNSSRECEIVER_BAUD */
+    (void)memset(prt, 0, sizeof(prt));
+    prt[0] = 1U;
+    prt[4] = 0xC0U;
+    prt[5] = 0x08U;
+    prt[8] = (U8)(GNSSRECEIVER_BAUD & 0xFF);
+    prt[9] = (U8)((GNSSRECEIVER_BAUD >> 8) & 0xFF);
+    prt[10] = (U8)((GNSSRECEIVER_BAUD >> 16) & 0xFF);
+    prt[12] = 0x27U;
+    prt[14] = 0x23U;
+
+    /* The receiver answers at the new baudrate already, don't wait for it */
+    if ((ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_PRT, prt, sizeof(prt), FALSE) == FALSE) ||
+        (tcdrain(fd) < 0) ||
+        (set_baud(fd, GNSSRECEIVER_BAUD) == FALSE) ||
+        (wait_sentence(fd, SENTENCE_TIMEOUT_MS) == FALSE))
+    {
+        aesdlog_err("gnssreceiver: no data after switching to %d baud", GNSSRECEIVER_BAUD);
+        return FALSE;
+    }
+
+    aesdlog_info("gnssreceiver: ready after %lld ms", monotonic_ms() - start);
+    return TRUE;
+}
+
+
+/* ---------------------------------------------  */
+/* Private functions */
+/* ---------------------------------------------  */
+
+
+static Boolean set_baud(int fd, int baud)
+{
+    struct termios tio;
+    speed_t speed;
+
+    switch (baud)
+    {
+        case 4800:   speed = B4800;   break;
+        case 9600:   speed = B9600;   break;
+        case 19200:  speed = B19200;  break;
+        case 38400:  speed = B38400;  break;
+        case 57600:  speed = B57600;  break;
+        case 115200: speed = B115200; break;
+        default:     return FALSE;
+    }
+
+    if (tcgetattr(fd, &tio) < 0)
+    {
+        aesdlog_err("tcgetattr: %s", strerror(errno));
+        return FALSE;
+    }
+
+    /* 8N1, no flow control, no echo */
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    (void)cfsetispeed(&tio, speed);
+    (void)cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    {
+        aesdlog_err("tcsetattr: %s", strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Reads records until one holds a sentence with a good checksum. At a
+ * wrong baudrate the line discipline still frames noise now and then,
+ * the checksum tells it apart.
+ */
+static Boolean wait_sentence(int fd, int timeout_ms)
+{
+    char buf[RECORD_BUF_SIZE];
+    struct gnssposget_rec rec;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    S64 deadline = monotonic_ms() + timeout_ms;
+    S64 left;
+    int ret, pos;
+
+    while ((left = deadline - monotonic_ms()) > 0)
+    {
+        if (poll(&pfd, 1, (int)left) <= 0)
+        {
+            continue;
+        }
+
+        ret = read(fd, buf, sizeof(buf) - 1U);
+        if (ret <= 0)
+        {
+            continue;
+        }
+
+        /* Complete records only, a partial one at the end is dropped */
+        buf[ret] = '\0';
+        for (pos = 0; (pos + (int)sizeof(rec)) <= ret; pos += (int)sizeof(rec) + rec.len)
+        {
+            (void)memcpy(&rec, &buf[pos], sizeof(rec));
+            if ((pos + (int)sizeof(rec) + rec.len) > ret)
+            {
+                break;
+            }
+
+            if ((rec.type == GNSSPOSGET_REC_NMEA) && (rec.len > 0U) &&
+                (buf[pos + sizeof(rec) + rec.len - 1U] == '\0') &&
+                (nmea_checksum_ok(&buf[pos + sizeof(rec)]) == TRUE))
+            {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+/* "$...*hh", XOR of everything between '$' and '*' */
+static Boolean nmea_checksum_ok(const char *sentence)
+{
+    unsigned int sum = 0U, expected;
+    const char *ptr;
+
+    if (sentence[0] != '$')
+    {
+        return FALSE;
+    }
+
+    for (ptr = &sentence[1]; (*ptr != '*') && (*ptr != '\0'); ptr++)
+    {
+        sum ^= (U8)*ptr;
+    }
+
+    if ((*ptr != '*') || (sscanf(ptr + 1, "%2X", &expected) != 1))
+    {
+        return FALSE;
+    }
+
+    return (sum == expected) ? TRUE : FALSE;
+}
+
+/*
+ * Writes one UBX frame through n_gnssposget. With wait_ack the write
+ * blocks until the receiver acknowledged a CFG message, see
+ * GNSSPOSGET_ACK_*. Failures are logged, the caller decides if they matter.
+ */
+static Boolean ubx_send(int fd, U8 cls, U8 id, const U8 *payload, U16 len, Boolean wait_ack)
+{
+    U8 frame[UBX_FRAME_MAX];
+    U8 ck_a = 0U, ck_b = 0U;
+    unsigned int i, frame_len = UBX_HEADER_LEN + len + 2U;
+    int flags = fcntl(fd, F_GETFL);
+    ssize_t ret;
+
+    if ((frame_len > sizeof(frame)) || (flags < 0))
+    {
+        return FALSE;
+    }
+
+    frame[0] = UBX_SYNC_1;
+    frame[1] = UBX_SYNC_2;
+    frame[2] = cls;
+    frame[3] = id;
+    frame[4] = (U8)(len & 0xFFU);
+    frame[5] = (U8)(len >> 8);
+    (void)memcpy(&frame[UBX_HEADER_LEN], payload, len);
+
+    /* Fletcher checksum over class, ID, length and payload */
+    for (i = 2U; i < (UBX_HEADER_LEN + len); i++)
+    {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+
+    frame[UBX_HEADER_LEN + len] = ck_a;
+    frame[UBX_HEADER_LEN + len + 1U] = ck_b;
+
+    (void)fcntl(fd, F_SETFL, (wait_ack == TRUE) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+    ret = write(fd, frame, frame_len);
+    (void)fcntl(fd, F_SETFL, flags);
+
+    if (ret != (ssize_t)frame_len)
+    {
+        aesdlog_err("gnssreceiver: UBX %02X-%02X: %s", cls, id,
+                    (ret < 0) ? strerror(errno) : "short write");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* CFG message that has to be acknowledged, what names it in the log */
+static Boolean ubx_configure(int fd, U8 id, const U8 *payload, U16 len, const char *what)
+{
+    int tries;
+
+    for (tries = 0; tries < UBX_CFG_TRIES; tries++)
+    {
+        if (ubx_send(fd, UBX_CLASS_CFG, id, payload, len, TRUE) == TRUE)
+        {
+            return TRUE;
+        }
+    }
+
+    aesdlog_err("gnssreceiver: %s not acknowledged after %d tries, giving up", what, UBX_CFG_TRIES);
+    return FALSE;
+}
+
+static S64 monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((S64)now.tv_sec * 1000LL) + (now.tv_nsec / 1000000L);
+}
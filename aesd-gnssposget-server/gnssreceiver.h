@@ -0,0 +1,14 @@
+#ifndef GNSSRECEIVER_H
+#define GNSSRECEIVER_H
+
+#include "typedefs.h"
+
+
+/* Baudrate and output rate the uBlox NEO-6M runs at once brought up */
+#define GNSSRECEIVER_BAUD           (19200)
+#define GNSSRECEIVER_RATE_MS        (200U)
+
+extern Boolean gnssreceiver_bring_up(int fd);
+
+
+#endif /* GNSSRECEIVER_H */
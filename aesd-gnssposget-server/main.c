@@ -18,9 +18,12 @@
 #include "gnssposget-server.h"
 #include "socket_connections.h"
 #include "aesdlog.h"
+#include "gnssinput.h"
 #include "typedefs.h"
 
 #define DAEMON_ARG                  ("-d")
+/* GNSS input, see gnssinput.h. Default is GNSSINPUT_DEFAULT */
+#define INPUT_ARG                   ("-i")
 
 
 void parse_args(int argc, char** argv);
@@ -62,27 +65,31 @@ int main(int argc, char** argv)
 
 void parse_args(int argc, char** argv)
 {
-    if (argc == 2)
+    int i;
+
+    for (i = 1; i < argc; i++)
     {
-        if (strcmp(argv[1], DAEMON_ARG) == 0)
+        if (strcmp(argv[i], DAEMON_ARG) == 0)
         {
             is_daemon = TRUE;
         }
+        else if ((strcmp(argv[i], INPUT_ARG) == 0) && ((i + 1) < argc))
+        {
+            i++;
+            if (gnssinput_select(argv[i]) == FALSE)
+            {
+                printf("Invalid input %s!\n", argv[i]);
+                exit(-1);
+            }
+        }
         else
         {
             printf("Invalid argument!\n");
-            exit(0);
+            printf("Usage: %s [%s] [%s ldisc:<tty>|uart:<tty>[@baud]|pty:<tty>|file:<path>[@speed]|stdin]\n",
+                   argv[0], DAEMON_ARG, INPUT_ARG);
+            exit(-1);
         }
     }
-    else if (argc > 2)
-    {
-        printf("Too many arguments!\n");
-        exit(-1);
-    }
-    else
-    {
-        /* all good */
-    }
 }
 
 